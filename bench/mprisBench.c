@@ -0,0 +1,470 @@
+// Micro benchmarks for the metadata, property and signal paths of the server.
+// The server is linked in as is, DeaDBeeF itself is replaced by the fake below.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "../src/mprisServer.h"
+#include "../src/mprisServerInternal.h"
+#include "../src/trackId.h"
+#include "../src/artCache.h"
+
+#define TRACK_COUNT 1000
+#define DEFAULT_ITERATIONS 100000
+#define WARMUP_ITERATIONS 1000
+
+//***********************
+//* ALLOCATION COUNTING *
+//***********************
+#ifdef __GLIBC__
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void *ptr, size_t size);
+
+static unsigned long allocationCount;
+
+void* malloc(size_t size) {
+	__atomic_fetch_add(&allocationCount, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+	__atomic_fetch_add(&allocationCount, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(count, size);
+}
+
+void* realloc(void *ptr, size_t size) {
+	__atomic_fetch_add(&allocationCount, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+static unsigned long getAllocationCount(void) {
+	return __atomic_load_n(&allocationCount, __ATOMIC_RELAXED);
+}
+#else
+static unsigned long getAllocationCount(void) {
+	return 0;
+}
+#endif
+
+//*****************
+//* FAKE DEADBEEF *
+//*****************
+static const char *fakeMetaKeys[] = {
+	"title", "album", "artist", "album artist", "tracknumber", "genre", "year", "comment", ":URI", NULL
+};
+
+struct FakeTrack {
+	DB_playItem_t item; // must stay first, the plugin only sees this part
+	int index;
+	char *values[G_N_ELEMENTS(fakeMetaKeys)];
+};
+
+static struct FakeTrack fakeTracks[TRACK_COUNT];
+static struct FakeTrack *fakePlayingTrack;
+static char fakePlaylist[64];
+
+static const char* fakeFindMeta(DB_playItem_t *track, const char *key) {
+	struct FakeTrack *fakeTrack = (struct FakeTrack *)track;
+
+	for (int i = 0; fakeMetaKeys[i]; i++) {
+		if (strcmp(fakeMetaKeys[i], key) == 0) {
+			return fakeTrack->values[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void fakeInitTracks(void) {
+	for (int i = 0; i < TRACK_COUNT; i++) {
+		struct FakeTrack *track = &fakeTracks[i];
+
+		track->index = i;
+		track->values[0] = g_strdup_printf("Title of track %d", i);
+		track->values[1] = g_strdup_printf("Album %d", i / 12);
+		track->values[2] = g_strdup_printf("Artist %d", i / 48);
+		track->values[3] = g_strdup_printf("Artist %d", i / 48);
+		track->values[4] = g_strdup_printf("%d", i % 12 + 1);
+		track->values[5] = g_strdup("Rock\nAlternative Rock\nIndie");
+		track->values[6] = g_strdup_printf("%d", 1970 + i % 50);
+		track->values[7] = g_strdup("Ripped with a benchmark");
+		track->values[8] = g_strdup_printf("/home/user/Music/Artist %d/Album %d/%02d.flac", i / 48, i / 12, i % 12 + 1);
+	}
+	fakePlayingTrack = &fakeTracks[TRACK_COUNT / 2];
+}
+
+static void fakeFreeTracks(void) {
+	for (int i = 0; i < TRACK_COUNT; i++) {
+		for (int j = 0; fakeMetaKeys[j]; j++) {
+			g_free(fakeTracks[i].values[j]);
+		}
+	}
+}
+
+// The "bytecode" is the format itself. Evaluating it resolves the first %field% or $meta(field) of the format,
+// which is enough to produce realistic strings for every field of metaFormatRecords.
+static char* fakeTfCompile(const char *format) {
+	return g_strdup(format);
+}
+
+static void fakeTfFree(char *bytecode) {
+	g_free(bytecode);
+}
+
+static int fakeTfEval(ddb_tf_context_t *ctx, const char *bytecode, char *out, int outSize) {
+	char key[64];
+	const char *start = strstr(bytecode, "$meta(");
+	const char *end;
+
+	if (start != NULL) {
+		start += strlen("$meta(");
+		end = strchr(start, ')');
+	} else {
+		start = strchr(bytecode, '%');
+		start = start != NULL ? start + 1 : NULL;
+		end = start != NULL ? strchr(start, '%') : NULL;
+	}
+
+	if (start == NULL || end == NULL || end - start >= (int)sizeof(key)) {
+		out[0] = '\0';
+		return 0;
+	}
+	memcpy(key, start, end - start);
+	key[end - start] = '\0';
+
+	const char *value;
+	if (strcmp(key, "_path_raw") == 0) {
+		value = fakeFindMeta(ctx->it, ":URI");
+	} else if (strcmp(key, "track number") == 0) {
+		value = fakeFindMeta(ctx->it, "tracknumber");
+	} else if (strcmp(key, "date") == 0) {
+		value = fakeFindMeta(ctx->it, "year");
+	} else {
+		value = fakeFindMeta(ctx->it, key);
+	}
+
+	return g_strlcpy(out, value != NULL ? value : "", outSize);
+}
+
+static void fakeNoop(void) {
+}
+
+static void fakeItemRef(DB_playItem_t *track) {
+}
+
+static DB_playItem_t* fakeGetPlayingTrack(void) {
+	return fakePlayingTrack != NULL ? &fakePlayingTrack->item : NULL;
+}
+
+static float fakeGetPlaypos(void) {
+	return 42.5f;
+}
+
+static int fakeGetCurrentPlaylist(void) {
+	return 0;
+}
+
+static ddb_playlist_t* fakeGetPlaylistForIdx(int idx) {
+	return (ddb_playlist_t *)fakePlaylist;
+}
+
+static ddb_playlist_t* fakeGetCurrentPlaylistHandle(void) {
+	return (ddb_playlist_t *)fakePlaylist;
+}
+
+static void fakePlaylistUnref(ddb_playlist_t *playlist) {
+}
+
+static int fakeGetItemIdx(ddb_playlist_t *playlist, DB_playItem_t *track, int iter) {
+	return ((struct FakeTrack *)track)->index;
+}
+
+static int fakeGetItemCount(ddb_playlist_t *playlist, int iter) {
+	return TRACK_COUNT;
+}
+
+static DB_playItem_t* fakeGetNext(DB_playItem_t *track, int iter) {
+	int index = ((struct FakeTrack *)track)->index + 1;
+
+	return index < TRACK_COUNT ? &fakeTracks[index].item : NULL;
+}
+
+static DB_playItem_t* fakeGetPrev(DB_playItem_t *track, int iter) {
+	int index = ((struct FakeTrack *)track)->index - 1;
+
+	return index >= 0 ? &fakeTracks[index].item : NULL;
+}
+
+static int fakeGetCursor(ddb_playlist_t *playlist, int iter) {
+	return 0;
+}
+
+static float fakeGetItemDuration(DB_playItem_t *track) {
+	return 215.3f;
+}
+
+static int fakeConfGetInt(const char *key, int def) {
+	return def;
+}
+
+static DB_conf_item_t* fakeConfFind(const char *group, DB_conf_item_t *prev) {
+	return NULL;
+}
+
+static float fakeVolumeGetDb(void) {
+	return -12.0f;
+}
+
+static int fakeOutputState(void) {
+	return OUTPUT_STATE_PLAYING;
+}
+
+static DB_output_t fakeOutput = {
+	.state = fakeOutputState
+};
+
+static DB_output_t* fakeGetOutput(void) {
+	return &fakeOutput;
+}
+
+static const char *fakeDecoderExts[] = { "mp3", "flac", "ogg", "opus", NULL };
+static DB_decoder_t fakeDecoder = {
+	.exts = fakeDecoderExts
+};
+static DB_decoder_t *fakeDecoders[] = { &fakeDecoder, NULL };
+
+static DB_decoder_t** fakeGetDecoderList(void) {
+	return fakeDecoders;
+}
+
+static const char *fakeVfsSchemes[] = { "http://", "https://", NULL };
+
+static const char** fakeGetSchemes(void) {
+	return fakeVfsSchemes;
+}
+
+static DB_vfs_t fakeVfs = {
+	.get_schemes = fakeGetSchemes
+};
+static DB_vfs_t *fakeVfsList[] = { &fakeVfs, NULL };
+
+static DB_vfs_t** fakeGetVfsList(void) {
+	return fakeVfsList;
+}
+
+static DB_playlist_t *fakePlaylistPlugins[] = { NULL };
+
+static DB_playlist_t** fakeGetPlaylistList(void) {
+	return fakePlaylistPlugins;
+}
+
+static DB_functions_t fakeDeadbeef = {
+	.streamer_get_playing_track = fakeGetPlayingTrack,
+	.streamer_get_playpos = fakeGetPlaypos,
+	.streamer_get_current_playlist = fakeGetCurrentPlaylist,
+	.plt_get_for_idx = fakeGetPlaylistForIdx,
+	.plt_get_curr = fakeGetCurrentPlaylistHandle,
+	.plt_unref = fakePlaylistUnref,
+	.plt_get_item_idx = fakeGetItemIdx,
+	.plt_get_item_count = fakeGetItemCount,
+	.plt_get_cursor = fakeGetCursor,
+	.pl_get_next = fakeGetNext,
+	.pl_get_prev = fakeGetPrev,
+	.pl_lock = fakeNoop,
+	.pl_unlock = fakeNoop,
+	.pl_item_ref = fakeItemRef,
+	.pl_item_unref = fakeItemRef,
+	.pl_find_meta = fakeFindMeta,
+	.pl_get_item_duration = fakeGetItemDuration,
+	.tf_compile = fakeTfCompile,
+	.tf_free = fakeTfFree,
+	.tf_eval = fakeTfEval,
+	.conf_get_int = fakeConfGetInt,
+	.conf_find = fakeConfFind,
+	.conf_lock = fakeNoop,
+	.conf_unlock = fakeNoop,
+	.get_output = fakeGetOutput,
+	.volume_get_db = fakeVolumeGetDb,
+	.plug_get_decoder_list = fakeGetDecoderList,
+	.plug_get_vfs_list = fakeGetVfsList,
+	.plug_get_playlist_list = fakeGetPlaylistList,
+};
+
+// Behaves like a warm artwork cache: every album has a cover on disk
+static char* fakeGetAlbumArt(const char *fname, const char *artist, const char *album, int size,
+                             artwork_callback callback, void *userData) {
+	return g_strdup_printf("/home/user/.cache/deadbeef/covers/%s/%s.jpg", artist, album);
+}
+
+static const char* fakeGetDefaultCover(void) {
+	return "/usr/share/deadbeef/pixmaps/noartwork.png";
+}
+
+static DB_artwork_plugin_t fakeArtwork = {
+	.get_album_art = fakeGetAlbumArt,
+	.get_default_cover = fakeGetDefaultCover
+};
+
+//*************
+//* BENCHMARK *
+//*************
+typedef void (*BenchmarkCb)(int iteration, void *userData);
+
+static int iterations = DEFAULT_ITERATIONS;
+static struct MprisData benchData;
+
+static int64_t getNanoseconds(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void runBenchmark(const char *name, BenchmarkCb benchmarkCb, void *userData) {
+	for (int i = 0; i < WARMUP_ITERATIONS; i++) {
+		benchmarkCb(i, userData);
+	}
+
+	unsigned long allocationsBefore = getAllocationCount();
+	int64_t start = getNanoseconds();
+
+	for (int i = 0; i < iterations; i++) {
+		benchmarkCb(i, userData);
+	}
+
+	int64_t elapsed = getNanoseconds() - start;
+	unsigned long allocations = getAllocationCount() - allocationsBefore;
+
+	printf("%-36s %12.1f ns/op %10.2f allocs/op\n", name, (double)elapsed / iterations, (double)allocations / iterations);
+}
+
+// Runs the PropertiesChanged flush so queued values are part of the measured cost
+static void drainContext(void) {
+	while (g_main_context_iteration(benchData.context, FALSE)) {
+	}
+}
+
+static void benchMetadataForItem(int iteration, void *userData) {
+	struct FakeTrack *track = &fakeTracks[iteration % TRACK_COUNT];
+	GVariant *metadata = getMetadataForItem(&track->item, trackIdLookup(&track->item), &benchData);
+
+	g_variant_unref(g_variant_ref_sink(metadata));
+}
+
+static void benchUpdateMetadataCache(int iteration, void *userData) {
+	updateMetadataCache(&benchData);
+}
+
+static void benchGetter(int iteration, void *userData) {
+	struct PropertyRecord *record = userData;
+	GVariant *value = record->getterCb(&benchData);
+
+	g_variant_unref(g_variant_ref_sink(value));
+}
+
+static void benchGetAllPlayerProperties(int iteration, void *userData) {
+	g_variant_unref(g_variant_ref_sink(getAllPlayerProperties(&benchData)));
+}
+
+static void benchEmitVolumeChanged(int iteration, void *userData) {
+	emitVolumeChanged(iteration % 2 ? -12.0f : -6.0f);
+	drainContext();
+}
+
+static void benchEmitSeeked(int iteration, void *userData) {
+	emitSeeked(iteration);
+}
+
+static void benchEmitMetadataChanged(int iteration, void *userData) {
+	fakePlayingTrack = &fakeTracks[iteration % TRACK_COUNT];
+	emitMetadataChanged(&benchData);
+	drainContext();
+}
+
+static void benchEmitCanGoChanged(int iteration, void *userData) {
+	fakePlayingTrack = &fakeTracks[iteration % 2 ? 0 : TRACK_COUNT / 2];
+	emitCanGoChanged(&benchData);
+	drainContext();
+}
+
+static void benchEmitPlaybackStatusChanged(int iteration, void *userData) {
+	emitPlaybackStatusChanged(iteration % 2 ? OUTPUT_STATE_PLAYING : OUTPUT_STATE_PAUSED, &benchData);
+	drainContext();
+}
+
+static void benchEmitLoopStatusChanged(int iteration, void *userData) {
+	emitLoopStatusChanged(iteration % 2 ? PLAYBACK_MODE_LOOP_ALL : PLAYBACK_MODE_NOLOOP);
+	drainContext();
+}
+
+static void benchEmitShuffleStatusChanged(int iteration, void *userData) {
+	emitShuffleStatusChanged(iteration % 2 ? PLAYBACK_ORDER_LINEAR : PLAYBACK_ORDER_SHUFFLE_TRACKS);
+	drainContext();
+}
+
+static void runGetterBenchmarks(const char *interfaceName, struct PropertyRecord *records) {
+	for (struct PropertyRecord *record = records; record->propertyName; record++) {
+		char *name = g_strdup_printf("Get %s.%s", interfaceName, record->propertyName);
+
+		runBenchmark(name, benchGetter, record);
+		g_free(name);
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+		if (iterations <= 0) {
+			fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	fakeInitTracks();
+	benchData.deadbeef = &fakeDeadbeef;
+	benchData.artwork = &fakeArtwork;
+	benchData.context = g_main_context_new();
+	benchData.signalDelay = 0;
+
+	g_main_context_push_thread_default(benchData.context);
+	serverData = &benchData;
+	loadMetaFormats(&fakeDeadbeef);
+	buildDispatchTables(&benchData);
+	for (int i = 0; i < TRACK_COUNT; i++) {
+		trackIdAcquire(&fakeTracks[i].item, &fakeDeadbeef);
+	}
+
+	printf("%d iterations, %d synthetic tracks\n", iterations, TRACK_COUNT);
+
+	runBenchmark("getMetadataForItem", benchMetadataForItem, NULL);
+	runBenchmark("updateMetadataCache", benchUpdateMetadataCache, NULL);
+
+	runGetterBenchmarks("MediaPlayer2", rootPropertyRecords);
+	runGetterBenchmarks("Player", playerPropertyRecords);
+	runBenchmark("GetAll Player", benchGetAllPlayerProperties, NULL);
+
+	runBenchmark("emitVolumeChanged", benchEmitVolumeChanged, NULL);
+	runBenchmark("emitSeeked", benchEmitSeeked, NULL);
+	runBenchmark("emitMetadataChanged", benchEmitMetadataChanged, NULL);
+	runBenchmark("emitCanGoChanged", benchEmitCanGoChanged, NULL);
+	runBenchmark("emitPlaybackStatusChanged", benchEmitPlaybackStatusChanged, NULL);
+	runBenchmark("emitLoopStatusChanged", benchEmitLoopStatusChanged, NULL);
+	runBenchmark("emitShuffleStatusChanged", benchEmitShuffleStatusChanged, NULL);
+
+	freePropertyChanges();
+	freeDispatchTables();
+	serverData = NULL;
+	freeMetadataCache(&fakeDeadbeef);
+	artCacheFree();
+	trackIdFreeAll(&fakeDeadbeef);
+	freeMetaFormats(&fakeDeadbeef);
+	g_main_context_pop_thread_default(benchData.context);
+	g_main_context_unref(benchData.context);
+	fakeFreeTracks();
+
+	return 0;
+}
@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "logging.h"
+#include "artCache.h"
+
+#define ART_CACHE_SIZE 64
+#define MAX_META_LENGTH 4096
+
+// Art URIs keyed by (directory of the track, artist, album), so all tracks of an album share one entry.
+// Entries are evicted least recently used first. Only accessed from the mpris main context.
+struct ArtCacheEntry {
+	char *directory; // not terminated in lookup probes, always use directoryLength
+	size_t directoryLength;
+	char *artist;
+	char *album;
+	char *artUri; // NULL if there is neither a cover nor a default cover
+	GList *link;
+};
+
+// Copies of the tags a lookup needs, so the playlist lock is not held while talking to the artwork plugin
+struct ArtQuery {
+	char uriBuf[MAX_META_LENGTH];
+	char artistBuf[MAX_META_LENGTH];
+	char albumBuf[MAX_META_LENGTH];
+	const char *uri;
+	const char *artist;
+	const char *album;
+};
+
+struct ArtLoaded {
+	struct MprisData *mprisData;
+	char *uri;
+	char *artist;
+	char *album;
+};
+
+static GHashTable *entries = NULL;
+static GQueue recentlyUsed = G_QUEUE_INIT;
+
+static guint hashEntry(const void *key) {
+	const struct ArtCacheEntry *entry = key;
+	guint hash = 5381;
+
+	for (size_t i = 0; i < entry->directoryLength; i++) {
+		hash = hash * 33 + (unsigned char)entry->directory[i];
+	}
+	hash = hash * 33 + (entry->artist != NULL ? g_str_hash(entry->artist) : 0);
+	hash = hash * 33 + (entry->album != NULL ? g_str_hash(entry->album) : 0);
+
+	return hash;
+}
+
+static gboolean equalEntry(const void *a, const void *b) {
+	const struct ArtCacheEntry *entryA = a;
+	const struct ArtCacheEntry *entryB = b;
+
+	return entryA->directoryLength == entryB->directoryLength
+			&& memcmp(entryA->directory, entryB->directory, entryA->directoryLength) == 0
+			&& g_strcmp0(entryA->artist, entryB->artist) == 0
+			&& g_strcmp0(entryA->album, entryB->album) == 0;
+}
+
+// Fills a probe entry that points into the given strings
+static void initProbe(struct ArtCacheEntry *probe, const char *uri, const char *artist, const char *album) {
+	const char *slash = uri != NULL ? strrchr(uri, '/') : NULL;
+
+	probe->directory = (char *)(uri != NULL ? uri : "");
+	probe->directoryLength = slash != NULL ? (size_t)(slash - uri) : strlen(probe->directory);
+	probe->artist = (char *)artist;
+	probe->album = (char *)album;
+}
+
+static void removeEntry(struct ArtCacheEntry *entry) {
+	g_hash_table_remove(entries, entry);
+	g_queue_delete_link(&recentlyUsed, entry->link);
+
+	g_free(entry->directory);
+	g_free(entry->artist);
+	g_free(entry->album);
+	g_free(entry->artUri);
+	g_free(entry);
+}
+
+static const char* copyMeta(char *buf, const char *value) {
+	if (value == NULL) {
+		return NULL;
+	}
+
+	g_strlcpy(buf, value, MAX_META_LENGTH);
+	return buf;
+}
+
+static gboolean onArtLoaded(void *userData) {
+	struct ArtLoaded *loaded = userData;
+
+	if (entries != NULL) {
+		struct ArtCacheEntry probe;
+		struct ArtCacheEntry *entry;
+
+		initProbe(&probe, loaded->uri, loaded->artist, loaded->album);
+		entry = g_hash_table_lookup(entries, &probe);
+		if (entry != NULL) {
+			removeEntry(entry);
+		}
+	}
+	emitArtworkChanged(loaded->mprisData);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void freeArtLoaded(void *userData) {
+	struct ArtLoaded *loaded = userData;
+
+	g_free(loaded->uri);
+	g_free(loaded->artist);
+	g_free(loaded->album);
+	g_free(loaded);
+}
+
+// Called from the artwork plugin's thread
+static void coverartCallback(const char *fname, const char *artist, const char *album, void *userData) {
+	if (fname != NULL) { // cover was not ready
+		struct MprisData *mprisData = userData;
+		struct ArtLoaded *loaded = g_new(struct ArtLoaded, 1);
+
+		debug("Async loaded cover for %s", album);
+		loaded->mprisData = mprisData;
+		loaded->uri = g_strdup(fname);
+		loaded->artist = g_strdup(artist);
+		loaded->album = g_strdup(album);
+		// dropped if the plugin stopped in the meantime
+		invokeOnServer(onArtLoaded, loaded, freeArtLoaded);
+	}
+}
+
+// Returns the art URI of the track or NULL. The string is owned by the cache and valid until the next call.
+const char* artCacheLookup(DB_playItem_t *track, struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+	struct ArtQuery query;
+	struct ArtCacheEntry probe;
+	struct ArtCacheEntry *entry;
+
+	if (entries == NULL) {
+		entries = g_hash_table_new(hashEntry, equalEntry);
+	}
+
+	deadbeef->pl_lock();
+	query.uri = copyMeta(query.uriBuf, deadbeef->pl_find_meta(track, ":URI"));
+	query.artist = copyMeta(query.artistBuf, deadbeef->pl_find_meta(track, "artist"));
+	query.album = copyMeta(query.albumBuf, deadbeef->pl_find_meta(track, "album"));
+	deadbeef->pl_unlock();
+
+	initProbe(&probe, query.uri, query.artist, query.album);
+	entry = g_hash_table_lookup(entries, &probe);
+	if (entry != NULL) {
+		g_queue_unlink(&recentlyUsed, entry->link);
+		g_queue_push_head_link(&recentlyUsed, entry->link);
+		return entry->artUri;
+	}
+
+	debug("getting cover for album %s", query.album);
+	char *artworkPath = mprisData->artwork->get_album_art(query.uri, query.artist, query.album, -1, coverartCallback,
+	                                                      mprisData);
+
+	entry = g_new(struct ArtCacheEntry, 1);
+	entry->directory = g_strndup(probe.directory, probe.directoryLength);
+	entry->directoryLength = probe.directoryLength;
+	entry->artist = g_strdup(query.artist);
+	entry->album = g_strdup(query.album);
+	if (artworkPath != NULL) {
+		debug("cover for %s ready. Artwork is: %s", query.album, artworkPath);
+		entry->artUri = g_strconcat("file://", artworkPath, NULL);
+		free(artworkPath);
+	} else {
+		// Replaced by onArtLoaded once the cover arrives
+		debug("cover for %s not ready. Using default artwork", query.album);
+		const char *defaultPath = mprisData->artwork->get_default_cover();
+		entry->artUri = defaultPath != NULL ? g_strconcat("file://", defaultPath, NULL) : NULL;
+	}
+
+	if (recentlyUsed.length >= ART_CACHE_SIZE) {
+		removeEntry(g_queue_peek_tail(&recentlyUsed));
+	}
+	g_queue_push_head(&recentlyUsed, entry);
+	entry->link = recentlyUsed.head;
+	g_hash_table_add(entries, entry);
+
+	return entry->artUri;
+}
+
+void artCacheFree(void) {
+	while (!g_queue_is_empty(&recentlyUsed)) {
+		removeEntry(g_queue_peek_head(&recentlyUsed));
+	}
+	if (entries != NULL) {
+		g_hash_table_unref(entries);
+		entries = NULL;
+	}
+}
@@ -0,0 +1,9 @@
+#ifndef ARTCACHE_H_
+#define ARTCACHE_H_
+
+#include "mprisServer.h"
+
+const char* artCacheLookup(DB_playItem_t*, struct MprisData*);
+void artCacheFree(void);
+
+#endif
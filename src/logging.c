@@ -1,21 +1,286 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "logging.h"
+
+#define LOG_RING_SIZE 128 // messages per thread, further ones are dropped until the flusher catches up
+#define LOG_MESSAGE_SIZE 256
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+	#define LOG_RINGS 1 // needs static mutexes and thread private destructors, older GLib always writes directly
+#endif
+
+// Messages are formatted into a ring buffer of the logging thread and written by a flusher thread, so logging
+// never blocks on stdout and lines of different threads are never interleaved. Without a running flusher
+// (before logStart, after logStop) messages are written directly.
+struct LogEntry {
+	uint64_t sequence;
+	int64_t time;
+	int level;
+	char message[LOG_MESSAGE_SIZE];
+};
+
+// Single producer (the owning thread), single consumer (the flusher)
+struct LogRing {
+	struct LogEntry entries[LOG_RING_SIZE];
+	unsigned int head; // written by the producer
+	unsigned int tail; // written by the flusher
+	unsigned int drainedHead; // head as of the flusher's last pass
+	uint64_t dropped;
+	uint64_t reportedDropped;
+	int id;
+	int inUse;
+	struct LogRing *next;
+};
+
+int logLevel = DEFAULT_LOG_LEVEL;
+static int logJson = 0;
+
+static uint64_t sequence = 0;
+static int flushing = 0;
+
+#ifdef LOG_RINGS
+// Rings are reused by new threads once their owner exits and live as long as the process, since any thread may
+// log at any time
+static GMutex ringsMutex;
+static struct LogRing *rings = NULL;
+static int ringCount = 0;
+
+static GMutex flusherMutex;
+static GCond flusherCond;
+static GThread *flusher = NULL;
+static int flusherRunning = 0;
+static int flushRequested = 0; // set by producers, the flusher sleeps until then instead of polling
+
+static void releaseRing(void *data) {
+	struct LogRing *ring = data;
+
+	__atomic_store_n(&ring->inUse, 0, __ATOMIC_RELEASE);
+}
+
+static GPrivate threadRing = G_PRIVATE_INIT(releaseRing);
+
+static struct LogRing* getRing(void) {
+	struct LogRing *ring = g_private_get(&threadRing);
+
+	if (ring != NULL) {
+		return ring;
+	}
+
+	g_mutex_lock(&ringsMutex);
+	for (ring = rings; ring != NULL; ring = ring->next) {
+		if (!__atomic_load_n(&ring->inUse, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+	}
+	if (ring == NULL) {
+		ring = g_new0(struct LogRing, 1);
+		ring->id = ringCount++;
+		ring->next = rings;
+		__atomic_store_n(&rings, ring, __ATOMIC_RELEASE);
+	}
+	ring->inUse = 1;
+	g_mutex_unlock(&ringsMutex);
+
+	g_private_set(&threadRing, ring);
+	return ring;
+}
+
+// Only the first message since the flusher's last pass takes the mutex
+static void wakeFlusher(void) {
+	if (!__atomic_exchange_n(&flushRequested, 1, __ATOMIC_ACQ_REL)) {
+		g_mutex_lock(&flusherMutex);
+		g_cond_signal(&flusherCond);
+		g_mutex_unlock(&flusherMutex);
+	}
+}
+#endif
+
+static void writeEntry(const struct LogEntry *entry, int thread) {
+	FILE *stream = entry->level == LOG_LEVEL_ERROR ? stderr : stdout;
+
+	if (__atomic_load_n(&logJson, __ATOMIC_RELAXED)) {
+		GString *line = g_string_sized_new(LOG_MESSAGE_SIZE + 64);
+
+		g_string_append_printf(line, "{\"time\":%" G_GINT64_FORMAT ",\"level\":\"%s\",\"thread\":%d,\"message\":\"",
+		                       entry->time, entry->level == LOG_LEVEL_ERROR ? "error" : "debug", thread);
+		for (const char *c = entry->message; *c != '\0'; c++) {
+			if (*c == '"' || *c == '\\') {
+				g_string_append_c(line, '\\');
+				g_string_append_c(line, *c);
+			} else if ((unsigned char)*c < 0x20) {
+				g_string_append_printf(line, "\\u%04x", (unsigned char)*c);
+			} else {
+				g_string_append_c(line, *c);
+			}
+		}
+		g_string_append(line, "\"}\n");
+		fputs(line->str, stream);
+		g_string_free(line, TRUE);
+	} else {
+		fprintf(stream, "\e[32m\e[1mMPRIS %s Info: \e[0m\e[34m%s\e[0m\n",
+		        entry->level == LOG_LEVEL_ERROR ? "Error" : "Debug", entry->message);
+	}
+}
+
+static void logMessage(int level, const char *fmt, va_list args) {
+	struct LogEntry direct;
+	struct LogEntry *entry = &direct;
+	struct LogRing *ring = NULL;
+	unsigned int head = 0;
+
+#ifdef LOG_RINGS
+	if (__atomic_load_n(&flushing, __ATOMIC_ACQUIRE)) {
+		ring = getRing();
+		head = ring->head;
+		if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE) {
+			__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		entry = &ring->entries[head % LOG_RING_SIZE];
+	}
+#endif
+
+	entry->sequence = __atomic_fetch_add(&sequence, 1, __ATOMIC_RELAXED);
+	entry->time = g_get_real_time();
+	entry->level = level;
+	g_vsnprintf(entry->message, LOG_MESSAGE_SIZE, fmt, args);
+
+	if (ring != NULL) {
+		__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+#ifdef LOG_RINGS
+		wakeFlusher();
+#endif
+	} else {
+		writeEntry(entry, -1);
+	}
+}
 
 void logDebug (const char *fmt, ...) {
 	va_list arg_ptr;
 	va_start(arg_ptr, fmt);
-	printf("\e[32m\e[1mMPRIS Debug Info: \e[0m\e[34m");
-	vprintf(fmt, arg_ptr);
-	printf("\e[0m\n");
+	logMessage(LOG_LEVEL_DEBUG, fmt, arg_ptr);
 	va_end(arg_ptr);
 }
 
 void logError (const char *fmt, ...) {
 	va_list arg_ptr;
 	va_start(arg_ptr, fmt);
-	fprintf(stderr, "\e[32m\e[1mMPRIS Error Info: \e[0m\e[34m");
-	vfprintf(stderr, fmt, arg_ptr);
-	fprintf(stderr, "\e[0m\n");
+	logMessage(LOG_LEVEL_ERROR, fmt, arg_ptr);
 	va_end(arg_ptr);
 }
 
+#ifdef LOG_RINGS
+struct PendingEntry {
+	struct LogEntry *entry;
+	int thread;
+};
+
+static int comparePending(const void *a, const void *b) {
+	const struct PendingEntry *pendingA = a;
+	const struct PendingEntry *pendingB = b;
+
+	return pendingA->entry->sequence < pendingB->entry->sequence ? -1
+			: pendingA->entry->sequence > pendingB->entry->sequence;
+}
+
+// Writes the messages of all rings in the order they were logged
+static void drainRings(GArray *pending) {
+	struct LogRing *ring;
+
+	for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+		unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		ring->drainedHead = head;
+		for (unsigned int i = ring->tail; i != head; i++) {
+			struct PendingEntry entry = { &ring->entries[i % LOG_RING_SIZE], ring->id };
+
+			g_array_append_val(pending, entry);
+		}
+	}
+	g_array_sort(pending, comparePending);
+
+	for (unsigned int i = 0; i < pending->len; i++) {
+		struct PendingEntry *entry = &g_array_index(pending, struct PendingEntry, i);
+
+		writeEntry(entry->entry, entry->thread);
+	}
+	g_array_set_size(pending, 0);
+
+	for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+		uint64_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+
+		// the sorted entries pointed into the rings, only now they may be overwritten
+		__atomic_store_n(&ring->tail, ring->drainedHead, __ATOMIC_RELEASE);
+		if (dropped != ring->reportedDropped) {
+			struct LogEntry entry = { 0, g_get_real_time(), LOG_LEVEL_ERROR, "" };
+
+			g_snprintf(entry.message, LOG_MESSAGE_SIZE, "%" G_GUINT64_FORMAT " log messages dropped",
+			           dropped - ring->reportedDropped);
+			writeEntry(&entry, ring->id);
+			ring->reportedDropped = dropped;
+		}
+	}
+	fflush(stdout);
+}
+
+static void* runFlusher(void *data) {
+	GArray *pending = g_array_new(FALSE, FALSE, sizeof(struct PendingEntry));
+
+	g_mutex_lock(&flusherMutex);
+	while (flusherRunning) {
+		while (flusherRunning && !__atomic_load_n(&flushRequested, __ATOMIC_ACQUIRE)) {
+			g_cond_wait(&flusherCond, &flusherMutex);
+		}
+		g_mutex_unlock(&flusherMutex);
+		// messages logged from now on request another pass
+		__atomic_store_n(&flushRequested, 0, __ATOMIC_RELEASE);
+		drainRings(pending);
+		g_mutex_lock(&flusherMutex);
+	}
+	g_mutex_unlock(&flusherMutex);
+	drainRings(pending);
+
+	g_array_free(pending, TRUE);
+	return NULL;
+}
+#endif
+
+void logConfigure(int level, int json) {
+	__atomic_store_n(&logLevel, level, __ATOMIC_RELAXED);
+	__atomic_store_n(&logJson, json, __ATOMIC_RELAXED);
+}
+
+void logStart(int level, int json) {
+	logConfigure(level, json);
+#ifdef LOG_RINGS
+	if (flusher != NULL) {
+		return;
+	}
+
+	flusherRunning = 1;
+	flusher = g_thread_new("mpris-log", runFlusher, NULL);
+	__atomic_store_n(&flushing, 1, __ATOMIC_RELEASE);
+#endif
+}
+
+// Writes the remaining messages and stops the flusher
+void logStop(void) {
+#ifdef LOG_RINGS
+	if (flusher == NULL) {
+		return;
+	}
+
+	__atomic_store_n(&flushing, 0, __ATOMIC_RELEASE);
+	g_mutex_lock(&flusherMutex);
+	flusherRunning = 0;
+	g_cond_signal(&flusherCond);
+	g_mutex_unlock(&flusherMutex);
+
+	g_thread_join(flusher);
+	flusher = NULL;
+#endif
+}
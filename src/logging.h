@@ -1,15 +1,30 @@
 #ifndef LOGGING_H_
 #define LOGGING_H_
 
-void logDebug (const char *fmt, ...);
-void logError (const char *fmt, ...);
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_DEBUG 1
 
 #ifndef MPRIS__DEBUG
-	#define debug(...)
+	#define DEFAULT_LOG_LEVEL LOG_LEVEL_ERROR
 #else
-	#define debug(...) logDebug(__VA_ARGS__)
+	#define DEFAULT_LOG_LEVEL LOG_LEVEL_DEBUG
 #endif
 
+extern int logLevel;
+
+void logDebug (const char *fmt, ...);
+void logError (const char *fmt, ...);
+void logStart(int, int);
+void logConfigure(int, int);
+void logStop(void);
+
+// The arguments are only evaluated if debug messages are enabled
+#define debug(...) do { \
+		if (__atomic_load_n(&logLevel, __ATOMIC_RELAXED) >= LOG_LEVEL_DEBUG) { \
+			logDebug(__VA_ARGS__); \
+		} \
+	} while (0)
+
 #define error(...) logError(__VA_ARGS__)
 
 #endif
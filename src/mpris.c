@@ -1,18 +1,156 @@
 #include <glib.h>
 
 #include "mprisServer.h"
+#include "trackList.h"
+#include "playlists.h"
+#include "prefetch.h"
+#include "position.h"
 #include "logging.h"
 
+#define SETTINGS_RELOAD_DELAY 1000 // ms
+
 static GThread *mprisThread;
 static struct MprisData mprisData;
 
 static int oldLoopStatus = -1;
 static int oldShuffleStatus = -1;
+static GSource *settingsReloadSource = NULL; // only accessed from the mpris main context
+
+// How handleEvent treats an event type. Events of coalesced types carry no payload, processEvent reads the current
+// state anyway, so while one of them is queued further ones are dropped. The counters are updated from DeaDBeeF's
+// message thread and logged when the plugin stops.
+struct EventFilter {
+	uint32_t id;
+	const char *name;
+	gboolean coalesce;
+	int queued;
+	uint64_t processed;
+	uint64_t dropped;
+};
+
+static struct EventFilter eventFilters[] = {
+	{ DB_EV_SEEKED,           "seeked",           FALSE },
+	{ DB_EV_TRACKINFOCHANGED, "trackinfochanged", FALSE },
+	{ DB_EV_SELCHANGED,       "selchanged",       TRUE  },
+	{ DB_EV_PLAYLISTSWITCHED, "playlistswitched", TRUE  },
+	{ DB_EV_PLAYLISTCHANGED,  "playlistchanged",  FALSE },
+	{ DB_EV_SONGSTARTED,      "songstarted",      FALSE },
+	{ DB_EV_PAUSED,           "paused",           FALSE },
+	{ DB_EV_STOP,             "stop",             FALSE },
+	{ DB_EV_VOLUMECHANGED,    "volumechanged",    TRUE  },
+	{ DB_EV_CONFIGCHANGED,    "configchanged",    TRUE  },
+	{ 0,                      NULL                      }
+};
+
+// Copy of a DeaDBeeF event, handed over to the mpris main context
+struct MprisEvent {
+	uint32_t id;
+	uint32_t p1;
+	uint32_t p2;
+	float playpos;
+	DB_playItem_t *track;
+	struct EventFilter *filter;
+};
+
+static void freeEvent(void *data) {
+	struct MprisEvent *event = data;
+
+	if (event->track != NULL) {
+		mprisData.deadbeef->pl_item_unref(event->track);
+	}
+	g_free(event);
+}
+
+static void resetEventFilters(void) {
+	for (struct EventFilter *filter = eventFilters; filter->name; filter++) {
+		__atomic_store_n(&filter->queued, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&filter->processed, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&filter->dropped, 0, __ATOMIC_RELAXED);
+	}
+}
+
+static void logEventFilters(void) {
+	for (struct EventFilter *filter = eventFilters; filter->name; filter++) {
+		debug("%s events: %" G_GUINT64_FORMAT " processed, %" G_GUINT64_FORMAT " dropped", filter->name,
+		      (guint64)__atomic_load_n(&filter->processed, __ATOMIC_RELAXED),
+		      (guint64)__atomic_load_n(&filter->dropped, __ATOMIC_RELAXED));
+	}
+}
+
+// Reads the plugin's own settings again, see scheduleSettingsReload
+static void reloadSettings(void) {
+	DB_functions_t *deadbeef = mprisData.deadbeef;
+
+	logConfigure(deadbeef->conf_get_int(SETTING_LOG_LEVEL, DEFAULT_LOG_LEVEL), deadbeef->conf_get_int(SETTING_LOG_JSON, 0));
+	mprisData.previousAction = deadbeef->conf_get_int(SETTING_PREVIOUS_ACTION, PREVIOUS_ACTION_PREV_OR_RESTART);
+	mprisData.signalDelay = deadbeef->conf_get_int(SETTING_SIGNAL_DELAY, 0);
+
+	int prefetchTime = deadbeef->conf_get_int(SETTING_PREFETCH_TIME, DEFAULT_PREFETCH_TIME);
+	if (prefetchTime != mprisData.prefetchTime) {
+		mprisData.prefetchTime = prefetchTime;
+		prefetchSchedule(&mprisData);
+	}
+
+	int lazyMetadata = deadbeef->conf_get_int(SETTING_LAZY_METADATA, 0);
+	gboolean lazyMetadataChanged = lazyMetadata != mprisData.lazyMetadata;
+	mprisData.lazyMetadata = lazyMetadata;
+
+	if (loadMetaFormats(deadbeef) || lazyMetadataChanged) {
+		debug("Metadata fields changed");
+		prefetchInvalidate(deadbeef);
+		trackListMetadataFormatChanged(&mprisData);
+		emitMetadataChanged(&mprisData);
+	}
+}
+
+static gboolean onSettingsReload(void *userData) {
+	g_source_unref(settingsReloadSource);
+	settingsReloadSource = NULL;
+	reloadSettings();
+
+	return G_SOURCE_REMOVE;
+}
+
+// DB_EV_CONFIGCHANGED does not say which key changed and other plugins write the config in bursts. The plugin's own
+// settings and the field table are only read again once the config was quiet for SETTINGS_RELOAD_DELAY, so a burst
+// costs one pass over them instead of one per write.
+static void scheduleSettingsReload(void) {
+	if (settingsReloadSource != NULL) {
+		g_source_destroy(settingsReloadSource);
+		g_source_unref(settingsReloadSource);
+	}
+
+	settingsReloadSource = g_timeout_source_new(SETTINGS_RELOAD_DELAY);
+	g_source_set_callback(settingsReloadSource, onSettingsReload, NULL, NULL);
+	g_source_attach(settingsReloadSource, mprisData.context);
+}
+
+static void cancelSettingsReload(void) {
+	if (settingsReloadSource != NULL) {
+		g_source_destroy(settingsReloadSource);
+		g_source_unref(settingsReloadSource);
+		settingsReloadSource = NULL;
+	}
+}
 
 static int onStart() {
+	logStart(mprisData.deadbeef->conf_get_int(SETTING_LOG_LEVEL, DEFAULT_LOG_LEVEL),
+	         mprisData.deadbeef->conf_get_int(SETTING_LOG_JSON, 0));
 	oldLoopStatus = mprisData.deadbeef->conf_get_int("playback.loop", 0);
 	oldShuffleStatus = mprisData.deadbeef->conf_get_int("playback.order", PLAYBACK_ORDER_LINEAR);
 	mprisData.previousAction = mprisData.deadbeef->conf_get_int(SETTING_PREVIOUS_ACTION, PREVIOUS_ACTION_PREV_OR_RESTART);
+	mprisData.signalDelay = mprisData.deadbeef->conf_get_int(SETTING_SIGNAL_DELAY, 0);
+	mprisData.prefetchTime = mprisData.deadbeef->conf_get_int(SETTING_PREFETCH_TIME, DEFAULT_PREFETCH_TIME);
+	mprisData.lazyMetadata = mprisData.deadbeef->conf_get_int(SETTING_LAZY_METADATA, 0);
+	mprisData.stats = mprisData.deadbeef->conf_get_int(SETTING_STATS, 0);
+	mprisData.sharedState = mprisData.deadbeef->conf_get_int(SETTING_SHARED_STATE, 0);
+	mprisData.peerSocket = mprisData.deadbeef->conf_get_int(SETTING_PEER_SOCKET, 0);
+	mprisData.deadbeef->conf_get_str(SETTING_STATS_FILE, "", mprisData.statsFile, sizeof(mprisData.statsFile));
+	loadMetaFormats(mprisData.deadbeef);
+	resetEventFilters();
+
+	mprisData.context = g_main_context_new();
+	openServerContext(mprisData.context);
 
 #if (GLIB_MAJOR_VERSION <= 2 && GLIB_MINOR_VERSION < 32)
 	mprisThread = g_thread_create(startServer, (void *)&mprisData, TRUE, NULL);
@@ -23,13 +161,20 @@ static int onStart() {
 }
 
 static int onStop() {
-	stopServer();
+	GMainContext *context = mprisData.context;
 
-#if (GLIB_MAJOR_VERSION <= 2 && GLIB_MINOR_VERSION < 32)
+	// from now on handleEvent and late artwork callbacks drop their work
+	closeServerContext();
+	stopServer(&mprisData);
+
+	// the server thread has to be done with the context before it can be freed
 	g_thread_join(mprisThread);
-#else
-	g_thread_unref(mprisThread);
-#endif
+	cancelSettingsReload();
+
+	mprisData.context = NULL;
+	g_main_context_unref(context);
+	logEventFilters();
+	logStop();
 
 	return 0;
 }
@@ -80,37 +225,90 @@ static int onConnect() {
 //* - Seeked            *
 //* - Loop status       *
 //* - Shuffle status    *
+//* - Track list        *
+//* - Playlists         *
 //***********************
-static int handleEvent (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+static gboolean processEvent(void *data) {
+	struct MprisEvent *event = data;
 	DB_functions_t *deadbeef = mprisData.deadbeef;
 
-	switch (id) {
+	// cleared before the state is read, so a change from now on queues the event again
+	__atomic_store_n(&event->filter->queued, 0, __ATOMIC_RELEASE);
+
+	switch (event->id) {
 		case DB_EV_SEEKED:
 			debug("DB_EV_SEEKED event received");
-			emitSeeked(((ddb_event_playpos_t *) ctx)->playpos);
+			emitSeeked(event->playpos);
+			positionUpdate(&mprisData);
+			prefetchSchedule(&mprisData);
 			break;
 		case DB_EV_TRACKINFOCHANGED:
 			debug("DB_EV_TRACKINFOCHANGED event received");
-			emitMetadataChanged(-1, &mprisData);
+			if (event->track != NULL) {
+				trackListTrackInfoChanged(event->track, &mprisData);
+				prefetchTrackInfoChanged(event->track, deadbeef);
+			}
+			// a tag rescan sends one event per track, only the current one affects Player
+			if (event->track == NULL || isCurrentTrack(event->track, &mprisData)) {
+				emitMetadataChanged(&mprisData);
+				emitCanGoChanged(&mprisData);
+				positionCheckDrift(&mprisData);
+			}
+			break;
+		case DB_EV_PLAYLISTCHANGED:
+			debug("DB_EV_PLAYLISTCHANGED event received");
+			if (!trackListUpdatePlaylist(&mprisData) && event->p1 == DDB_PLAYLIST_CHANGE_CONTENT) {
+				trackListContentChanged(&mprisData);
+			}
+			if (event->p1 == DDB_PLAYLIST_CHANGE_CONTENT) {
+				emitCanGoChanged(&mprisData);
+			}
+
+			switch (event->p1) {
+				case DDB_PLAYLIST_CHANGE_CREATED:
+				case DDB_PLAYLIST_CHANGE_DELETED:
+				case DDB_PLAYLIST_CHANGE_POSITION:
+					playlistsStructureChanged(&mprisData);
+					break;
+				case DDB_PLAYLIST_CHANGE_TITLE:
+					playlistsTitleChanged(&mprisData);
+					break;
+				default:
+					break;
+			}
+			break;
+		case DB_EV_PLAYLISTSWITCHED:
+			playlistsActiveChanged(&mprisData);
+			if (trackListUpdatePlaylist(&mprisData)) {
+				emitMetadataChanged(&mprisData);
+			}
 			emitCanGoChanged(&mprisData);
-			emitSeeked(deadbeef->streamer_get_playpos());
 			break;
 		case DB_EV_SELCHANGED:
-		case DB_EV_PLAYLISTSWITCHED:
 			emitCanGoChanged(&mprisData);
 			break;
 		case DB_EV_SONGSTARTED:
 			debug("DB_EV_SONGSTARTED event received");
-			emitMetadataChanged(-1, &mprisData);
+			trackListUpdatePlaylist(&mprisData);
+			emitMetadataChanged(&mprisData);
 			emitPlaybackStatusChanged(OUTPUT_STATE_PLAYING, &mprisData);
+			emitCanGoChanged(&mprisData);
+			positionUpdate(&mprisData);
+			prefetchSchedule(&mprisData);
 			break;
 		case DB_EV_PAUSED:
 			debug("DB_EV_PAUSED event received");
-			emitPlaybackStatusChanged(p1 ? OUTPUT_STATE_PAUSED : OUTPUT_STATE_PLAYING, &mprisData);
+			emitPlaybackStatusChanged(event->p1 ? OUTPUT_STATE_PAUSED : OUTPUT_STATE_PLAYING, &mprisData);
+			positionUpdate(&mprisData);
+			prefetchSchedule(&mprisData);
 			break;
 		case DB_EV_STOP:
 			debug("DB_EV_STOP event received");
+			prefetchCancel();
+			updateMetadataCache(&mprisData);
 			emitPlaybackStatusChanged(OUTPUT_STATE_STOPPED, &mprisData);
+			emitCanGoChanged(&mprisData);
+			positionUpdate(&mprisData);
 			break;
 		case DB_EV_VOLUMECHANGED:
 			debug("DB_EV_VOLUMECHANGED event received");
@@ -122,21 +320,79 @@ static int handleEvent (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
 				int newLoopStatus = mprisData.deadbeef->conf_get_int("playback.loop", PLAYBACK_MODE_LOOP_ALL);
 				int newShuffleStatus = mprisData.deadbeef->conf_get_int("playback.order", PLAYBACK_ORDER_LINEAR);
 
+				gboolean navigationChanged = FALSE;
+
 				if (newLoopStatus != oldLoopStatus) {
 					debug("LoopStatus changed %d", newLoopStatus);
 					emitLoopStatusChanged(oldLoopStatus = newLoopStatus);
+					navigationChanged = TRUE;
 				} if (newShuffleStatus != oldShuffleStatus) {
 					debug("ShuffleStatus changed %d", newShuffleStatus);
 					emitShuffleStatusChanged(oldShuffleStatus = newShuffleStatus);
+					navigationChanged = TRUE;
+				}
+				if (navigationChanged) {
+					emitCanGoChanged(&mprisData);
 				}
 
-				mprisData.previousAction = mprisData.deadbeef->conf_get_int(SETTING_PREVIOUS_ACTION, PREVIOUS_ACTION_PREV_OR_RESTART);
+				scheduleSettingsReload();
 			}
 			break;
 		default:
 			break;
 	}
 
+	return G_SOURCE_REMOVE;
+}
+
+// Runs on DeaDBeeF's message thread. The event is only copied and processed later on the mpris main context, so
+// the player never waits for D-Bus.
+static int handleEvent (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+	struct EventFilter *filter = eventFilters;
+
+	while (filter->name != NULL && filter->id != id) {
+		filter++;
+	}
+	if (filter->name == NULL) {
+		return 0;
+	}
+
+	// the navigation flags only depend on the selection while nothing is playing
+	if (id == DB_EV_SELCHANGED) {
+		DB_output_t *output = mprisData.deadbeef->get_output();
+
+		if (output != NULL && output->state() != OUTPUT_STATE_STOPPED) {
+			__atomic_fetch_add(&filter->dropped, 1, __ATOMIC_RELAXED);
+			return 0;
+		}
+	}
+
+	if (filter->coalesce && __atomic_exchange_n(&filter->queued, 1, __ATOMIC_ACQ_REL)) {
+		__atomic_fetch_add(&filter->dropped, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	struct MprisEvent *event = g_new0(struct MprisEvent, 1);
+	event->id = id;
+	event->filter = filter;
+	event->p1 = p1;
+	event->p2 = p2;
+	if (id == DB_EV_SEEKED) {
+		event->playpos = ((ddb_event_playpos_t *)ctx)->playpos;
+	} else if (id == DB_EV_TRACKINFOCHANGED && ctx != 0) {
+		event->track = ((ddb_event_track_t *)ctx)->track;
+		if (event->track != NULL) {
+			mprisData.deadbeef->pl_item_ref(event->track);
+		}
+	}
+
+	// the plugin is stopping
+	if (!invokeOnServer(processEvent, event, freeEvent)) {
+		__atomic_fetch_add(&filter->dropped, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	__atomic_fetch_add(&filter->processed, 1, __ATOMIC_RELAXED);
+
 	return 0;
 }
 
@@ -144,7 +400,17 @@ static int handleEvent (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
 #define XSTR(x) STR(x)
 
 static const char settings_dlg[] =
-	"property \"\\\"Previous\\\" action behavior\" select[2] " SETTING_PREVIOUS_ACTION " " XSTR(PREVIOUS_ACTION_PREV_OR_RESTART) " \"Previous\" \"Previous or restart current track\";";
+	"property \"\\\"Previous\\\" action behavior\" select[2] " SETTING_PREVIOUS_ACTION " " XSTR(PREVIOUS_ACTION_PREV_OR_RESTART) " \"Previous\" \"Previous or restart current track\";"
+	"property \"PropertiesChanged merge delay (ms, 0 = next main loop iteration)\" entry " SETTING_SIGNAL_DELAY " 0;"
+	"property \"Prefetch next track metadata (seconds before the end, 0 = off)\" entry " SETTING_PREFETCH_TIME " " XSTR(DEFAULT_PREFETCH_TIME) ";"
+	"property \"Send lyrics and comments only to clients which read Metadata\" checkbox " SETTING_LAZY_METADATA " 0;"
+	"property \"Collect call statistics (applies after restart)\" checkbox " SETTING_STATS " 0;"
+	"property \"Write call statistics on exit to\" entry " SETTING_STATS_FILE " \"\";"
+	"property \"Playlist for OpenUri (empty = current playlist)\" entry " SETTING_OPEN_URI_PLAYLIST " \"\";"
+	"property \"Publish playback state in shared memory (applies after restart)\" checkbox " SETTING_SHARED_STATE " 0;"
+	"property \"Accept direct D-Bus connections on $XDG_RUNTIME_DIR/deadbeef-mpris2.sock (applies after restart)\" checkbox " SETTING_PEER_SOCKET " 0;"
+	"property \"Log level\" select[2] " SETTING_LOG_LEVEL " " XSTR(DEFAULT_LOG_LEVEL) " \"Errors\" \"Debug\";"
+	"property \"Log as JSON lines\" checkbox " SETTING_LOG_JSON " 0;";
 
 
 DB_misc_t plugin = {
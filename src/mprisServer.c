@@ -3,27 +3,50 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <assert.h>
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
 
 #include "logging.h"
 #include "mprisServer.h"
+#include "mprisServerInternal.h"
+#include "trackId.h"
+#include "trackList.h"
+#include "playlists.h"
+#include "artCache.h"
+#include "prefetch.h"
+#include "position.h"
+#include "stats.h"
+#include "openUri.h"
+#include "transport.h"
+#include "sharedState.h"
 
 #define BUS_NAME "org.mpris.MediaPlayer2.DeaDBeeF"
-#define OBJECT_NAME "/org/mpris/MediaPlayer2"
-#define PLAYER_INTERFACE "org.mpris.MediaPlayer2.Player"
-#define PROPERTIES_INTERFACE "org.freedesktop.DBus.Properties"
 #define CURRENT_TRACK -1
-
-typedef GVariant* (*ProduceVariantCb)(const char *valueStr);
+#define PEER_SOCKET_NAME "deadbeef-mpris2.sock"
+#define WORKER_THREADS 2 // for slow method calls, see MethodRecord.pooled
+#define MAX_STACK_TOKENS 32
+#define SCRATCH_INITIAL_SIZE 1024
+#define SCRATCH_MAX_SIZE (4 * 1024 * 1024)
+#define METADATA_LIGHT_FIELDS 1
+#define METADATA_HEAVY_FIELDS 2
+#define METADATA_ALL_FIELDS (METADATA_LIGHT_FIELDS | METADATA_HEAVY_FIELDS)
+#define HEAVY_SUFFIX ",heavy"
+
+// valueStr points into the scratch buffer and may be modified
+typedef GVariant* (*ProduceVariantCb)(char *valueStr);
 
 struct MetaFormatRecord {
 	const char *fieldName;
 	const char *valueFormat;
-	const ProduceVariantCb produceVariantCb;
+	ProduceVariantCb produceVariantCb;
+	gboolean heavy; // left out of broadcasts in lazy metadata mode
 	char *bytecode;
 };
 
@@ -80,27 +103,117 @@ static const char xmlForNode[] =
 	"			<annotation name='org.freedesktop.DBus.Property.EmitsChangedSignal' value='false'/>"
 	"		</property>"
 	"	</interface>"
+	"	<interface name='org.mpris.MediaPlayer2.TrackList'>"
+	"		<method name='GetTracksMetadata'>"
+	"			<arg name='TrackIds'     type='ao'     direction='in'/>"
+	"			<arg name='Metadata'     type='aa{sv}' direction='out'/>"
+	"		</method>"
+	"		<method name='AddTrack'>"
+	"			<arg name='Uri'          type='s'      direction='in'/>"
+	"			<arg name='AfterTrack'   type='o'      direction='in'/>"
+	"			<arg name='SetAsCurrent' type='b'      direction='in'/>"
+	"		</method>"
+	"		<method name='RemoveTrack'>"
+	"			<arg name='TrackId'      type='o'      direction='in'/>"
+	"		</method>"
+	"		<method name='GoTo'>"
+	"			<arg name='TrackId'      type='o'      direction='in'/>"
+	"		</method>"
+	"		<signal name='TrackListReplaced'>"
+	"			<arg name='Tracks'       type='ao'/>"
+	"			<arg name='CurrentTrack' type='o'/>"
+	"		</signal>"
+	"		<signal name='TrackAdded'>"
+	"			<arg name='Metadata'     type='a{sv}'/>"
+	"			<arg name='AfterTrack'   type='o'/>"
+	"		</signal>"
+	"		<signal name='TrackRemoved'>"
+	"			<arg name='TrackId'      type='o'/>"
+	"		</signal>"
+	"		<signal name='TrackMetadataChanged'>"
+	"			<arg name='TrackId'      type='o'/>"
+	"			<arg name='Metadata'     type='a{sv}'/>"
+	"		</signal>"
+	"		<property access='read' name='Tracks'        type='ao'>"
+	"			<annotation name='org.freedesktop.DBus.Property.EmitsChangedSignal' value='invalidates'/>"
+	"		</property>"
+	"		<property access='read' name='CanEditTracks' type='b'/>"
+	"	</interface>"
+	"	<interface name='org.mpris.MediaPlayer2.Playlists'>"
+	"		<method name='ActivatePlaylist'>"
+	"			<arg name='PlaylistId'   type='o'      direction='in'/>"
+	"		</method>"
+	"		<method name='GetPlaylists'>"
+	"			<arg name='Index'        type='u'      direction='in'/>"
+	"			<arg name='MaxCount'     type='u'      direction='in'/>"
+	"			<arg name='Order'        type='s'      direction='in'/>"
+	"			<arg name='ReverseOrder' type='b'      direction='in'/>"
+	"			<arg name='Playlists'    type='a(oss)' direction='out'/>"
+	"		</method>"
+	"		<signal name='PlaylistChanged'>"
+	"			<arg name='Playlist'     type='(oss)'/>"
+	"		</signal>"
+	"		<property access='read' name='PlaylistCount'  type='u'/>"
+	"		<property access='read' name='Orderings'      type='as'/>"
+	"		<property access='read' name='ActivePlaylist' type='(b(oss))'/>"
+	"	</interface>"
+	"	<interface name='org.deadbeef.Mpris'>"
+	"		<method name='GetFullMetadata'>"
+	"			<arg name='TrackId'      type='o'      direction='in'/>"
+	"			<arg name='Metadata'     type='a{sv}'  direction='out'/>"
+	"		</method>"
+	"	</interface>"
+	"	<interface name='org.deadbeef.MprisStats'>"
+	"		<method name='Dump'>"
+	"			<arg name='Counters'     type='a(sstttat)' direction='out'/>"
+	"		</method>"
+	"	</interface>"
 	"</node>";
 
+// Everything below is only touched from the mpris main context. DeaDBeeF events are handed over to it by
+// handleEvent, so no locking is needed.
 static GDBusConnection *globalConnection = NULL;
-static GMainLoop *loop;
 
-static gboolean bytecodeCompiled;
+// Optional peer to peer endpoint. Local clients of the same user connect to its socket directly instead of going
+// through the bus daemon and see the same objects and signals as bus clients.
+static GDBusServer *peerServer = NULL;
+static GSList *peerConnections = NULL;
 
-static GVariant* produceScalarString(const char *valueStr) {
+static GMainLoop *loop;
+struct MprisData *serverData = NULL;
+
+// Properties which changed since the last PropertiesChanged signal. They are merged and sent as one signal
+// once the main loop gets idle (or after the configured delay). The last emitted values are kept to drop
+// changes which do not actually change anything.
+static GHashTable *pendingProperties = NULL;
+static GHashTable *emittedProperties = NULL;
+static GSource *flushSource = NULL;
+
+// Compiled metadata fields, the defaults merged with the "mpris2.field." settings. Built in onStart before the
+// mpris thread exists and afterwards only replaced on the mpris main context.
+static struct MetaFormatRecord *metaFormatRecords = NULL;
+static char *metaFormatConfig = NULL;
+// tf_eval output buffer shared by all metadata builds, grown when a field (usually lyrics) does not fit
+static char *scratch = NULL;
+static size_t scratchSize = 0;
+
+// Metadata of the playing track. Rebuilt on song/track info changes so property reads only have to take a reference.
+static GVariant *cachedMetadata = NULL;
+static DB_playItem_t *cachedTrack = NULL;
+// cachedMetadata including the heavy fields, built when a client reads Metadata in lazy metadata mode
+static GVariant *cachedFullMetadata = NULL;
+
+static GVariant* produceScalarString(char *valueStr) {
 	return g_variant_new_string(valueStr);
 }
 
-static GVariant* produceSingleStringArray(const char *valueStr) {
-	GVariantBuilder arrayBuilder;
-	g_variant_builder_init(&arrayBuilder, G_VARIANT_TYPE("as"));
-
-	g_variant_builder_add(&arrayBuilder, "s", valueStr);
+static GVariant* produceSingleStringArray(char *valueStr) {
+	const char *values[] = { valueStr };
 
-	return g_variant_builder_end(&arrayBuilder);
+	return g_variant_new_strv(values, 1);
 }
 
-static GVariant* produceScalarInt(const char *valueStr) {
+static GVariant* produceScalarInt(char *valueStr) {
 	gint32 value = atoi(valueStr);
 
 	if (value <= 0) {
@@ -110,748 +223,1944 @@ static GVariant* produceScalarInt(const char *valueStr) {
 	return g_variant_new_int32(value);
 }
 
-static char* chompCr(char *str) {
-	size_t len = strlen(str);
+// Splits valueStr at newlines in place. Up to MAX_STACK_TOKENS tokens are collected without touching the heap.
+static GVariant* produceArrayOfTokens(char *valueStr) {
+	const char *stackTokens[MAX_STACK_TOKENS];
+	const char **tokens = stackTokens;
+	int tokenCount = 1;
 
-	if (len > 0 && str[len - 1] == '\r') {
-		str[len - 1] = '\0';
+	for (const char *c = valueStr; *c; c++) {
+		if (*c == '\n') {
+			tokenCount++;
+		}
+	}
+	if (tokenCount > MAX_STACK_TOKENS) {
+		tokens = g_new(const char *, tokenCount);
 	}
 
-	return str;
-}
-
-static GVariant* produceArrayOfTokens(const char *valueStr) {
-	char **tokens = g_strsplit(valueStr, "\n", -1);
+	char *token = valueStr;
+	for (int i = 0; i < tokenCount; i++) {
+		char *end = strchr(token, '\n');
 
-	GVariantBuilder arrayBuilder;
-	g_variant_builder_init(&arrayBuilder, G_VARIANT_TYPE("as"));
+		if (end != NULL) {
+			*end = '\0';
+		} else {
+			end = token + strlen(token);
+		}
+		if (end > token && end[-1] == '\r') {
+			end[-1] = '\0';
+		}
 
-	for (char **token = tokens; *token; token++) {
-		g_variant_builder_add(&arrayBuilder, "s", chompCr(*token));
+		tokens[i] = token;
+		token = end + 1;
 	}
 
-	g_strfreev(tokens);
+	GVariant *result = g_variant_new_strv(tokens, tokenCount);
+	if (tokens != stackTokens) {
+		g_free(tokens);
+	}
 
-	return g_variant_builder_end(&arrayBuilder);
+	return result;
 }
 
-static struct MetaFormatRecord metaFormatRecords[] = {
-	{ "xesam:title",          "%title%",                                                 produceScalarString      },
-	{ "xesam:album",          "%album%",                                                 produceScalarString      },
-	{ "xesam:artist",         "$if(%artist%,%artist%,Unknown Artist)",                   produceSingleStringArray },
-	{ "xesam:albumArtist",    "%album artist%",                                          produceSingleStringArray },
-	{ "xesam:trackNumber",    "%track number%",                                          produceScalarInt         },
-	{ "xesam:genre",          "%genre%",                                                 produceArrayOfTokens     },
-	{ "xesam:contentCreated", "%date%",                                                  produceScalarString      }, //TODO format date
-	{ "xesam:asText",         "$meta(unsynced lyrics)",                                  produceScalarString      },
-	{ "xesam:comment",        "$meta(comment)",                                          produceSingleStringArray },
-	{ "xesam:url",            "$if($strcmp($left(%_path_raw%,1),/),file://)%_path_raw%", produceScalarString      },
-	{ NULL                                                                                                        }
+struct MetaTypeRecord {
+	const char *typeName;
+	ProduceVariantCb produceVariantCb;
 };
 
-static void compileTfBytecode(DB_functions_t *deadbeef) {
-	debug("Compiling tf bytecode");
-	for (struct MetaFormatRecord *record = metaFormatRecords; record->fieldName; record++) {
-		record->bytecode = deadbeef->tf_compile(record->valueFormat);
-		assert(record->bytecode);
+static struct MetaTypeRecord metaTypeRecords[] = {
+	{ "string", produceScalarString      },
+	{ "array",  produceSingleStringArray },
+	{ "int",    produceScalarInt         },
+	{ "lines",  produceArrayOfTokens     },
+	{ NULL                               }
+};
+
+static const struct MetaFormatRecord defaultMetaFormatRecords[] = {
+	{ "xesam:title",          "%title%",                                                 produceScalarString,      FALSE },
+	{ "xesam:album",          "%album%",                                                 produceScalarString,      FALSE },
+	{ "xesam:artist",         "$if(%artist%,%artist%,Unknown Artist)",                   produceSingleStringArray, FALSE },
+	{ "xesam:albumArtist",    "%album artist%",                                          produceSingleStringArray, FALSE },
+	{ "xesam:trackNumber",    "%track number%",                                          produceScalarInt,         FALSE },
+	{ "xesam:genre",          "%genre%",                                                 produceArrayOfTokens,     FALSE },
+	{ "xesam:contentCreated", "%date%",                                                  produceScalarString,      FALSE }, //TODO format date
+	{ "xesam:asText",         "$meta(unsynced lyrics)",                                  produceScalarString,      TRUE  },
+	{ "xesam:comment",        "$meta(comment)",                                          produceSingleStringArray, TRUE  },
+	{ "xesam:url",            "$if($strcmp($left(%_path_raw%,1),/),file://)%_path_raw%", produceScalarString,      FALSE },
+	{ NULL                                                                                                               }
+};
+
+// Field overrides as "<field>=<type>[,heavy]:<title format>" lines. Also used to tell whether the fields need recompiling.
+static char* readMetaFormatConfig(DB_functions_t *deadbeef) {
+	GString *config = g_string_new(NULL);
+
+	deadbeef->conf_lock();
+	for (DB_conf_item_t *item = deadbeef->conf_find(SETTING_FIELD_PREFIX, NULL); item != NULL;
+			item = deadbeef->conf_find(SETTING_FIELD_PREFIX, item)) {
+		g_string_append_printf(config, "%s=%s\n", item->key + strlen(SETTING_FIELD_PREFIX), item->value);
 	}
+	deadbeef->conf_unlock();
+
+	return g_string_free(config, FALSE);
 }
 
-static void freeTfBytecode(DB_functions_t *deadbeef) {
-	debug("Freeing tf bytecode");
-	for (struct MetaFormatRecord *record = metaFormatRecords; record->fieldName; record++) {
-		deadbeef->tf_free(record->bytecode);
+static ProduceVariantCb lookupMetaType(const char *typeName, size_t typeNameLength) {
+	for (struct MetaTypeRecord *record = metaTypeRecords; record->typeName; record++) {
+		if (strlen(record->typeName) == typeNameLength && strncmp(record->typeName, typeName, typeNameLength) == 0) {
+			return record->produceVariantCb;
+		}
 	}
+
+	return NULL;
 }
 
-static void coverartCallback(const char *fname, const char *artist, const char *album, void *userData) {
-	if (fname != NULL) { // cover was not ready
-		debug("Async loaded cover for %s", album);
-		emitMetadataChanged(-1, userData);
+static int findMetaFormatRecord(GArray *records, const char *fieldName) {
+	for (unsigned int i = 0; i < records->len; i++) {
+		if (strcmp(g_array_index(records, struct MetaFormatRecord, i).fieldName, fieldName) == 0) {
+			return i;
+		}
 	}
-}
 
-GVariant* getMetadataForTrack(int track_id, struct MprisData *mprisData) {
-	int id;
-	DB_playItem_t *track = NULL;
-	DB_functions_t *deadbeef = mprisData->deadbeef;
-	ddb_playlist_t *pl = NULL;
-	GVariant *tmp;
-	GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
-	int playlistIndex;
+	return -1;
+}
 
-	track = deadbeef->streamer_get_playing_track();
-	if (track) {
-		pl = deadbeef->plt_get_for_idx(deadbeef->streamer_get_current_playlist());
-		id = deadbeef->plt_get_item_idx(pl, track, PL_MAIN);
-		playlistIndex = deadbeef->streamer_get_current_playlist();
-	}
-	if (pl) {
-		deadbeef->plt_unref(pl);
+static void freeMetaFormatRecord(struct MetaFormatRecord *record, DB_functions_t *deadbeef) {
+	if (record->bytecode != NULL) {
+		deadbeef->tf_free(record->bytecode);
 	}
+	g_free((char *)record->fieldName);
+	g_free((char *)record->valueFormat);
+}
 
-	if (track != NULL) {
-		char buf[500];
-		int buf_size = sizeof(buf);
-		int64_t duration = deadbeef->pl_get_item_duration(track) * 1000000;
-		const char *album = deadbeef->pl_find_meta(track, "album");
-		const char *artist = deadbeef->pl_find_meta(track, "artist");
-		const char *uri = deadbeef->pl_find_meta(track, ":URI");
-
-		deadbeef->pl_lock();
-
-		sprintf(buf, "/DeaDBeeF/%d/%d", playlistIndex, id);
-		debug("get Metadata trackid: %s", buf);
-		g_variant_builder_add(builder, "{sv}", "mpris:trackid", g_variant_new("o", buf));
-
-		debug("get Metadata duration: %" PRId64, duration);
-		if (duration > 0) {
-			g_variant_builder_add(builder, "{sv}", "mpris:length", g_variant_new("x", duration));
-		}
-
-		if (mprisData->artwork != NULL) {
-			char *artworkPath = NULL;
-			char *albumArtUri = NULL;
-
-			debug("getting cover for album %s", album);
-			artworkPath = mprisData->artwork->get_album_art(uri, artist, album, -1, coverartCallback, mprisData);
-			if (artworkPath == NULL) {
-				debug("cover for %s not ready. Using default artwork", album);
-				const char *defaultPath = mprisData->artwork->get_default_cover();
-				if (defaultPath != NULL) {
-					albumArtUri = malloc(strlen(defaultPath) + 7 + 1); // strlen(defaultPath) + strlen("file://") + "/0"
-
-					strcpy(albumArtUri, "file://");
-					strcpy(albumArtUri + 7, defaultPath);
-				}
-			} else {
-				debug("cover for %s ready. Artwork is: %s", album, artworkPath);
-				albumArtUri = malloc(strlen(artworkPath) + 7 + 1); // strlen(artworkPath) + strlen("file://") + "/0"
-
-				strcpy(albumArtUri, "file://");
-				strcpy(albumArtUri + 7, artworkPath);
+// Merges the defaults with the config and compiles the result into a { NULL } terminated table.
+// An override with an empty value removes the field, so unwanted fields are never evaluated.
+static struct MetaFormatRecord* buildMetaFormatRecords(const char *config, DB_functions_t *deadbeef) {
+	GArray *records = g_array_new(TRUE, TRUE, sizeof(struct MetaFormatRecord));
 
-				free(artworkPath);
-			}
+	for (const struct MetaFormatRecord *record = defaultMetaFormatRecords; record->fieldName; record++) {
+		struct MetaFormatRecord copy = {
+			g_strdup(record->fieldName), g_strdup(record->valueFormat), record->produceVariantCb, record->heavy, NULL
+		};
+		g_array_append_val(records, copy);
+	}
 
-			if (albumArtUri != NULL) {
-				g_variant_builder_add(builder, "{sv}", "mpris:artUrl", g_variant_new("s", albumArtUri));
-				free(albumArtUri);
+	char **lines = g_strsplit(config, "\n", -1);
+	for (char **line = lines; *line; line++) {
+		char *value = strchr(*line, '=');
+		if (value == NULL) {
+			continue;
+		}
+		*value++ = '\0';
+
+		int idx = findMetaFormatRecord(records, *line);
+		if (*value == '\0') {
+			debug("Removing metadata field %s", *line);
+			if (idx >= 0) {
+				freeMetaFormatRecord(&g_array_index(records, struct MetaFormatRecord, idx), deadbeef);
+				g_array_remove_index(records, idx);
 			}
+			continue;
 		}
 
-		// init on first access
-		if (!bytecodeCompiled) {
-			compileTfBytecode(deadbeef);
-			bytecodeCompiled = TRUE;
+		char *format = strchr(value, ':');
+		size_t typeLength = format != NULL ? (size_t)(format - value) : 0;
+		gboolean heavy = typeLength > strlen(HEAVY_SUFFIX)
+				&& strncmp(format - strlen(HEAVY_SUFFIX), HEAVY_SUFFIX, strlen(HEAVY_SUFFIX)) == 0;
+		if (heavy) {
+			typeLength -= strlen(HEAVY_SUFFIX);
 		}
 
-		for (struct MetaFormatRecord *record = metaFormatRecords; record->fieldName; record++) {
-			assert(record->valueFormat);
-			assert(record->produceVariantCb);
-			assert(record->bytecode);
-
-			ddb_tf_context_t ctx = {
-				sizeof(ddb_tf_context_t),
-				DDB_TF_CONTEXT_NO_DYNAMIC | DDB_TF_CONTEXT_MULTILINE,
-				track,
-				NULL,
-				0,
-				0,
-				PL_MAIN,
-				0
-			};
-
-			if (deadbeef->tf_eval(&ctx, record->bytecode, buf, buf_size) < 0) {
-				error("failed to produce string for field %s", record->fieldName);
-				continue;
-			}
-
-			if (g_str_equal(buf, "")) {
-				debug("resulting string is empty, skipping %s field", record->fieldName);
-				continue;
-			}
-
-			debug("got string '%s' for field %s", buf, record->fieldName);
+		ProduceVariantCb produceVariantCb = format != NULL ? lookupMetaType(value, typeLength) : NULL;
+		if (produceVariantCb == NULL) {
+			error("invalid setting %s%s, expected <string|array|int|lines>[,heavy]:<title format>",
+			      SETTING_FIELD_PREFIX, *line);
+			continue;
+		}
+		format++;
 
-			GVariant *variant = record->produceVariantCb(buf);
-			if (!variant) {
-				debug("can't convert string '%s' to proper variant, skipping %s field", buf, record->fieldName);
-				continue;
-			}
+		debug("Metadata field %s uses format %s", *line, format);
+		if (idx >= 0) {
+			struct MetaFormatRecord *record = &g_array_index(records, struct MetaFormatRecord, idx);
 
-			g_variant_builder_add(builder, "{sv}", record->fieldName, variant);
+			g_free((char *)record->valueFormat);
+			record->valueFormat = g_strdup(format);
+			record->produceVariantCb = produceVariantCb;
+			record->heavy = heavy;
+		} else {
+			struct MetaFormatRecord record = { g_strdup(*line), g_strdup(format), produceVariantCb, heavy, NULL };
+			g_array_append_val(records, record);
 		}
-
-		deadbeef->pl_unlock();
-		deadbeef->pl_item_unref(track);
-	} else {
-		debug("get Metadata trackid: /org/mpris/MediaPlayer2/TrackList/NoTrack");
-		g_variant_builder_add(builder, "{sv}", "mpris:trackid", g_variant_new("o", "/org/mpris/MediaPlayer2/TrackList/NoTrack"));
 	}
-	tmp = g_variant_builder_end(builder);
-	g_variant_builder_unref(builder);
+	g_strfreev(lines);
 
-	return tmp;
-}
+	for (unsigned int i = 0; i < records->len;) {
+		struct MetaFormatRecord *record = &g_array_index(records, struct MetaFormatRecord, i);
 
-gboolean deadbeef_can_seek(DB_functions_t *deadbeef) {
-	gboolean can_seek = FALSE;
-	DB_output_t *output = deadbeef->get_output();
-	if (output) {
-		DB_playItem_t *track = deadbeef->streamer_get_playing_track();
-		if (track) {
-			can_seek = deadbeef->pl_get_item_duration(track) > 0;
-			deadbeef->pl_item_unref(track);
+		record->bytecode = deadbeef->tf_compile(record->valueFormat);
+		if (record->bytecode == NULL) {
+			error("failed to compile title format '%s' for field %s", record->valueFormat, record->fieldName);
+			freeMetaFormatRecord(record, deadbeef);
+			g_array_remove_index(records, i);
+			continue;
 		}
+		i++;
 	}
-	return can_seek;
-}
 
-static gboolean deadbeef_hasselectedorplayingtrack(struct MprisData *userData, int offset) {
-	DB_functions_t *deadbeef = ((struct MprisData *)userData)->deadbeef;
-	ddb_playlist_t *pl = NULL;
-	DB_playItem_t *playing_track = deadbeef->streamer_get_playing_track();
-	int idx;
-	if (playing_track) {
-		pl = deadbeef->plt_get_for_idx(deadbeef->streamer_get_current_playlist());
-		if (pl) {
-			idx = deadbeef->plt_get_item_idx(pl, playing_track, PL_MAIN) + offset;
-		}
-		deadbeef->pl_item_unref(playing_track);
-	} else {
-		pl = deadbeef->plt_get_curr();
-		if (pl) {
-			idx = deadbeef->plt_get_cursor(pl, PL_MAIN) + offset;
-		}
-	}
+	return (struct MetaFormatRecord *)g_array_free(records, FALSE);
+}
 
-	if (pl) {
-		DB_playItem_t *track = deadbeef->plt_get_item_for_idx(pl, idx, PL_MAIN);
-		deadbeef->plt_unref(pl);
-		if (track) {
-			deadbeef->pl_item_unref(track);
-			return TRUE;
-		}
+static void freeMetaFormatRecords(struct MetaFormatRecord *records, DB_functions_t *deadbeef) {
+	for (struct MetaFormatRecord *record = records; record->fieldName; record++) {
+		freeMetaFormatRecord(record, deadbeef);
 	}
-	return FALSE;
+	g_free(records);
 }
 
-static void onRootMethodCallHandler(GDBusConnection *connection, const char *sender, const char *objectPath,
-                                    const char *interfaceName, const char *methodName, GVariant *parameters,
-                                    GDBusMethodInvocation *invocation, void *userData) {
-	debug("Method call on root interface. sender: %s, methodName %s", sender, methodName);
-	DB_functions_t *deadbeef = ((struct MprisData *)userData)->deadbeef;
+// Returns TRUE if the fields changed since the last call
+gboolean loadMetaFormats(DB_functions_t *deadbeef) {
+	char *config = readMetaFormatConfig(deadbeef);
 
-	if (strcmp(methodName, "Quit") == 0) {
-		g_dbus_method_invocation_return_value(invocation, NULL);
-		deadbeef->sendmessage(DB_EV_TERMINATE, 0, 0, 0);
-	} else if (strcmp(methodName, "Raise") == 0) {
-		GDesktopAppInfo *dskapp = g_desktop_app_info_new ("deadbeef.desktop");
-		if (dskapp) {
-			g_app_info_launch ((GAppInfo *) dskapp, NULL, NULL, NULL);
-			g_object_unref (dskapp);
-		} else {
-			deadbeef->sendmessage (DB_EV_ACTIVATED, 0, 0, 0);
-		}
-		g_dbus_method_invocation_return_value(invocation, NULL);
-	} else {
-		debug("Error! Unsupported method. %s.%s", interfaceName, methodName);
-		g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
-                                              "Method %s.%s not supported", interfaceName, methodName);
+	if (metaFormatRecords != NULL && strcmp(config, metaFormatConfig) == 0) {
+		g_free(config);
+		return FALSE;
 	}
-}
 
-static GVariant* onRootGetPropertyHandler(GDBusConnection *connection, const char *sender, const char *objectPath,
-                                          const char *interfaceName, const char *propertyName, GError **error,
-                                          void *userData) {
-	debug("Get property call on root interface. sender: %s, propertyName: %s", sender, propertyName);
-	GVariant *result = NULL;
-
-	if (strcmp(propertyName, "CanQuit") == 0) {
-		result = g_variant_new_boolean(TRUE);
-	} else if (strcmp(propertyName, "CanRaise") == 0) {
-		result = g_variant_new_boolean(TRUE);
-	} else if (strcmp(propertyName, "HasTrackList") == 0) {
-		result = g_variant_new_boolean(FALSE);
-	} else if (strcmp(propertyName, "Identity") == 0) {
-		result = g_variant_new_string("DeaDBeeF");
-	} else if (strcmp(propertyName, "DesktopEntry") == 0) {
-		result = g_variant_new_string("deadbeef");
-	} else if (strcmp(propertyName, "SupportedUriSchemes") == 0) {
-		GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("as"));
-		//TODO find uri schemata
-		g_variant_builder_add(builder, "s", "file");
-		g_variant_builder_add(builder, "s", "http");
-		g_variant_builder_add(builder, "s", "cdda");
-		result = g_variant_builder_end(builder);
-		g_variant_builder_unref(builder);
-	} else if (strcmp(propertyName, "SupportedMimeTypes") == 0){
-		GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("as"));
-
-		// MIME types from the .desktop file
-		g_variant_builder_add(builder, "s", "audio/aac");
-		g_variant_builder_add(builder, "s", "audio/aacp");
-		g_variant_builder_add(builder, "s", "audio/x-it");
-		g_variant_builder_add(builder, "s", "audio/x-flac");
-		g_variant_builder_add(builder, "s", "audio/x-mod");
-		g_variant_builder_add(builder, "s", "audio/mpeg");
-		g_variant_builder_add(builder, "s", "audio/x-mpeg");
-		g_variant_builder_add(builder, "s", "audio/x-mpegurl");
-		g_variant_builder_add(builder, "s", "audio/mp3");
-		g_variant_builder_add(builder, "s", "audio/prs.sid");
-		g_variant_builder_add(builder, "s", "audio/x-scpls");
-		g_variant_builder_add(builder, "s", "audio/x-s3m");
-		g_variant_builder_add(builder, "s", "application/ogg");
-		g_variant_builder_add(builder, "s", "application/x-ogg");
-		g_variant_builder_add(builder, "s", "audio/x-vorbis+ogg");
-		g_variant_builder_add(builder, "s", "audio/ogg");
-		g_variant_builder_add(builder, "s", "audio/wma");
-		g_variant_builder_add(builder, "s", "audio/x-xm");
-		result = g_variant_builder_end(builder);
+	debug("Compiling metadata fields");
+	struct MetaFormatRecord *records = buildMetaFormatRecords(config, deadbeef);
+	if (metaFormatRecords != NULL) {
+		freeMetaFormatRecords(metaFormatRecords, deadbeef);
+		g_free(metaFormatConfig);
 	}
-	return result;
+	metaFormatRecords = records;
+	metaFormatConfig = config;
+
+	return TRUE;
 }
 
-static const GDBusInterfaceVTable rootInterfaceVTable = {
-	onRootMethodCallHandler,
-	onRootGetPropertyHandler,
-	NULL
-};
+void freeMetaFormats(DB_functions_t *deadbeef) {
+	debug("Freeing metadata fields");
+	if (metaFormatRecords != NULL) {
+		freeMetaFormatRecords(metaFormatRecords, deadbeef);
+		g_free(metaFormatConfig);
+		metaFormatRecords = NULL;
+		metaFormatConfig = NULL;
+	}
 
-static void onPlayerMethodCallHandler(GDBusConnection *connection, const char *sender, const char *objectPath,
-                                      const char *interfaceName, const char *methodName, GVariant *parameters,
-                                      GDBusMethodInvocation *invocation, void *userData) {
-	debug("Method call on Player interface. sender: %s, methodName %s", sender, methodName);
-	debug("Parameter signature is %s", g_variant_get_type_string (parameters));
-	struct MprisData *mprisData = (struct MprisData *)userData;
-	DB_functions_t *deadbeef = mprisData->deadbeef;
+	g_free(scratch);
+	scratch = NULL;
+	scratchSize = 0;
+}
 
-	if (strcmp(methodName, "Next") == 0) {
-		g_dbus_method_invocation_return_value(invocation, NULL);
-		deadbeef->sendmessage(DB_EV_NEXT, 0, 0, 0);
-	} else if (strcmp(methodName, "Previous") == 0) {
-		g_dbus_method_invocation_return_value(invocation, NULL);
+// Evaluates the record into the scratch buffer. tf_eval silently truncates, so a completely filled buffer is grown
+// and the evaluation repeated. Returns the length of the value or -1.
+static int evalMetaFormatRecord(ddb_tf_context_t *ctx, struct MetaFormatRecord *record, DB_functions_t *deadbeef) {
+	if (scratch == NULL) {
+		scratchSize = SCRATCH_INITIAL_SIZE;
+		scratch = g_malloc(scratchSize);
+	}
 
-		if (mprisData->previousAction == PREVIOUS_ACTION_PREV_OR_RESTART && mprisData->prevOrRestart && mprisData->prevOrRestart->callback2 != NULL) {
-			mprisData->prevOrRestart->callback2(mprisData->prevOrRestart, DDB_ACTION_CTX_MAIN);
-		} else {
-			deadbeef->sendmessage(DB_EV_PREV, 0, 0, 0);
-		}
-	} else if (strcmp(methodName, "Pause") == 0) {
-		g_dbus_method_invocation_return_value(invocation, NULL);
-		deadbeef->sendmessage(DB_EV_PAUSE, 0, 0, 0);
-	} else if (strcmp(methodName, "PlayPause") == 0) {
-		g_dbus_method_invocation_return_value(invocation, NULL);
+	for (;;) {
+		int length = deadbeef->tf_eval(ctx, record->bytecode, scratch, scratchSize);
 
-		if (deadbeef->get_output()->state() == OUTPUT_STATE_PLAYING) {
-			deadbeef->sendmessage(DB_EV_PAUSE, 0, 0, 0);
-		} else {
-			deadbeef->sendmessage(DB_EV_PLAY_CURRENT, 0, 0, 0);
+		if (length < 0 || (size_t)length < scratchSize - 1 || scratchSize >= SCRATCH_MAX_SIZE) {
+			return length;
 		}
 
-	} else if (strcmp(methodName, "Stop") == 0) {
-		g_dbus_method_invocation_return_value(invocation, NULL);
-		deadbeef->sendmessage(DB_EV_STOP, 0, 0, 0);
-	} else if (strcmp(methodName, "Play") == 0) {
-		if (deadbeef->get_output()->state() != OUTPUT_STATE_PLAYING)
-			deadbeef->sendmessage(DB_EV_PLAY_CURRENT, 0, 0, 0);
-		g_dbus_method_invocation_return_value(invocation, NULL);
-	} else if (strcmp(methodName, "Seek") == 0) {
-		DB_playItem_t *track = deadbeef->streamer_get_playing_track();
+		scratchSize *= 2;
+		scratch = g_realloc(scratch, scratchSize);
+		debug("Grew scratch buffer to %zu bytes for field %s", scratchSize, record->fieldName);
+	}
+}
 
-		if (track != NULL) {
-			float durationInMilliseconds = deadbeef->pl_get_item_duration(track) * 1000.0;
-			float positionInMilliseconds= deadbeef->streamer_get_playpos() * 1000.0;
-			int64_t offsetInMicroseconds;
-			g_variant_get(parameters, "(x)", &offsetInMicroseconds);
-			float offsetInMilliseconds = offsetInMicroseconds / 1000.0;
+// Evaluates the title formats of the given field classes into builder
+static void addMetaFormatFields(GVariantBuilder *builder, DB_playItem_t *track, int fields, DB_functions_t *deadbeef) {
+	deadbeef->pl_lock();
 
-			float newPositionInMilliseconds = positionInMilliseconds + offsetInMilliseconds;
-			if (newPositionInMilliseconds < 0) {
-				newPositionInMilliseconds = 0;
-			}
-			if (newPositionInMilliseconds > durationInMilliseconds) {
-				deadbeef->sendmessage(DB_EV_NEXT, 0, 0, 0);
-			} else {
-				deadbeef->sendmessage(DB_EV_SEEK, 0, newPositionInMilliseconds, 0);
-			}
+	for (struct MetaFormatRecord *record = metaFormatRecords; record->fieldName; record++) {
+		assert(record->valueFormat);
+		assert(record->produceVariantCb);
+		assert(record->bytecode);
 
-			deadbeef->pl_item_unref(track);
+		if (!(fields & (record->heavy ? METADATA_HEAVY_FIELDS : METADATA_LIGHT_FIELDS))) {
+			continue;
 		}
-		g_dbus_method_invocation_return_value(invocation, NULL);
-	} else if (strcmp(methodName, "SetPosition") == 0) {
-		int64_t position = 0;
-		const char *trackId = NULL;
 
-		g_variant_get(parameters, "(&ox)", &trackId, &position);
-		debug("Set %s position %d.", trackId, position);
-
-		DB_playItem_t *track = deadbeef->streamer_get_playing_track();
-		if (track != NULL) {
-			ddb_playlist_t *pl = deadbeef->plt_get_for_idx(deadbeef->streamer_get_current_playlist());
-			int playid = deadbeef->plt_get_item_idx(pl, track, PL_MAIN);
-			int playlistIndex = deadbeef->streamer_get_current_playlist();
-			char buf[200];
-			sprintf(buf, "/DeaDBeeF/%d/%d", playlistIndex, playid);
-			if (strcmp(buf, trackId) == 0) {
-				deadbeef->sendmessage(DB_EV_SEEK, 0, position / 1000.0, 0);
-			}
-			deadbeef->pl_item_unref(track);
-			deadbeef->plt_unref(pl);
-		}
-		g_dbus_method_invocation_return_value(invocation, NULL);
-	} else if (strcmp(methodName, "OpenUri") == 0) {
-		const char *uri = NULL;
-
-		g_variant_get(parameters, "(&s)", &uri);
-		debug("OpenUri: %s\n", uri);
-		//TODO it is probably better to create a new playlist for that. Maybe we can even play it without playlist
-		ddb_playlist_t *pl = deadbeef->plt_get_curr();
-		int ret = deadbeef->plt_add_file2(0, pl, uri, NULL, NULL);
-		if (ret == 0) {
-			ddb_playlist_t *pl = deadbeef->plt_get_curr();
-			DB_playItem_t *track = deadbeef->plt_get_last(pl, PL_MAIN);
-			int track_id = deadbeef->plt_get_item_idx(pl, track, PL_MAIN);
-			deadbeef->plt_unref(pl);
-			deadbeef->pl_item_unref(track);
-			deadbeef->sendmessage(DB_EV_PLAY_NUM, 0, track_id, 0);
+		ddb_tf_context_t ctx = {
+			sizeof(ddb_tf_context_t),
+			DDB_TF_CONTEXT_NO_DYNAMIC | DDB_TF_CONTEXT_MULTILINE,
+			track,
+			NULL,
+			0,
+			0,
+			PL_MAIN,
+			0
+		};
+
+		int length = evalMetaFormatRecord(&ctx, record, deadbeef);
+		if (length < 0) {
+			error("failed to produce string for field %s", record->fieldName);
+			continue;
 		}
-		g_dbus_method_invocation_return_value(invocation, NULL);
-	} else {
-		debug("Error! Unsupported method. %s.%s", interfaceName, methodName);
-		g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
-                                              "Method %s.%s not supported", interfaceName, methodName);
-	}
-}
 
-static GVariant* onPlayerGetPropertyHandler(GDBusConnection *connection, const char *sender, const char *objectPath,
-                                            const char *interfaceName, const char *propertyName, GError **error,
-                                            void *userData) {
-	debug("Get property call on Player interface. sender: %s, propertyName: %s", sender, propertyName);
-	DB_functions_t *deadbeef = ((struct MprisData *)userData)->deadbeef;
-	GVariant *result = NULL;
-
-	if (strcmp(propertyName, "PlaybackStatus") == 0) {
-		DB_output_t *output = deadbeef->get_output();
-
-		if (output != NULL) {
-			switch (output->state()) {
-			case OUTPUT_STATE_PLAYING:
-				result = g_variant_new_string("Playing");
-				break;
-			case OUTPUT_STATE_PAUSED:
-				result = g_variant_new_string("Paused");
-				break;
-			case OUTPUT_STATE_STOPPED:
-			default:
-				result = g_variant_new_string("Stopped");
-				break;
-			}
-		} else {
-			result = g_variant_new_string("Stopped");
-		}
-	} else if (strcmp(propertyName, "LoopStatus") == 0) {
-		int loop = deadbeef->conf_get_int("playback.loop", PLAYBACK_MODE_LOOP_ALL);
-
-		switch (loop) {
-		case PLAYBACK_MODE_NOLOOP:
-			result = g_variant_new_string("None");
-			break;
-		case PLAYBACK_MODE_LOOP_ALL:
-			result = g_variant_new_string("Playlist");
-			break;
-		case PLAYBACK_MODE_LOOP_SINGLE:
-			result = g_variant_new_string("Track");
-			break;
-		default:
-			result = g_variant_new_string("None");
-			break;
-		}
-	} else if (strcmp(propertyName, "Rate") == 0
-			|| strcmp(propertyName, "MaximumRate") == 0
-			|| strcmp(propertyName, "MinimumRate") == 0) {
-		result = g_variant_new("d", 1.0);
-	} else if (strcmp(propertyName, "Shuffle") == 0) {
-		if (deadbeef->conf_get_int("playback.order", PLAYBACK_ORDER_LINEAR) == PLAYBACK_ORDER_LINEAR) {
-			result = g_variant_new_boolean(FALSE);
-		} else {
-			result = g_variant_new_boolean(TRUE);
+		if (length == 0 || scratch[0] == '\0') {
+			debug("resulting string is empty, skipping %s field", record->fieldName);
+			continue;
 		}
-	} else if (strcmp(propertyName, "Metadata") == 0) {
-		result = getMetadataForTrack(CURRENT_TRACK, userData);
-	} else if (strcmp(propertyName, "Volume") == 0) {
-		float volume = (deadbeef->volume_get_db() * 0.02) + 1;
 
-		result = g_variant_new("d", volume);
-	} else if (strcmp(propertyName, "Position") == 0) {
-		DB_playItem_t *track = deadbeef->streamer_get_playing_track();
-
-		if (track == NULL) {
-			result = g_variant_new("x", 0);
-		} else {
-			float positionInSeconds = deadbeef->streamer_get_playpos();
+		debug("got string '%s' for field %s", scratch, record->fieldName);
 
-			result = g_variant_new("x", (uint64_t)(positionInSeconds * 1000000.0));
-			deadbeef->pl_item_unref(track);
+		GVariant *variant = record->produceVariantCb(scratch);
+		if (!variant) {
+			debug("can't convert string '%s' to proper variant, skipping %s field", scratch, record->fieldName);
+			continue;
 		}
-	} else if (strcmp(propertyName, "CanGoNext") == 0) {
-		result = g_variant_new_boolean(deadbeef_hasselectedorplayingtrack(userData, 1));
-	} else if (strcmp(propertyName, "CanGoPrevious") == 0) {
-		result = g_variant_new_boolean(deadbeef_hasselectedorplayingtrack(userData, -1));
-	} else if (strcmp(propertyName, "CanPlay") == 0) {
-		result = g_variant_new_boolean(deadbeef_hasselectedorplayingtrack(userData, 0));
-	} else if (strcmp(propertyName, "CanPause") == 0) {
-		result = g_variant_new_boolean(TRUE);
-	} else if (strcmp(propertyName, "CanSeek") == 0) {
-		result = g_variant_new_boolean(deadbeef_can_seek(deadbeef));
-	} else if (strcmp(propertyName, "CanControl") == 0) {
-		result = g_variant_new_boolean(TRUE);
+
+		g_variant_builder_add(builder, "{sv}", record->fieldName, variant);
 	}
-	return result;
+
+	deadbeef->pl_unlock();
 }
 
-static int onPlayerSetPropertyHandler(GDBusConnection *connection, const char *sender, const char *objectPath,
-                                      const char *interfaceName, const char *propertyName, GVariant *value,
-                                      GError **error, gpointer userData) {
-	debug("Set property call on Player interface. sender: %s, propertyName: %s", sender, propertyName);
-	DB_functions_t *deadbeef = ((struct MprisData *)userData)->deadbeef;
+static GVariant* buildMetadata(DB_playItem_t *track, const char *trackId, int fields, struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+	GVariantBuilder builder;
+	int64_t duration = deadbeef->pl_get_item_duration(track) * 1000000;
 
-	if (strcmp(propertyName, "LoopStatus") == 0) {
-		char *status;
-		g_variant_get(value, "s", &status);
-		if (status != NULL) {
-			debug("status is %s", status);
-			if (strcmp(status, "None") == 0) {
-				deadbeef->conf_set_int("playback.loop", PLAYBACK_MODE_NOLOOP);
-			} else if (strcmp(status, "Playlist") == 0) {
-				deadbeef->conf_set_int("playback.loop", PLAYBACK_MODE_LOOP_ALL);
-			} else if (strcmp(status, "Track") == 0) {
-				deadbeef->conf_set_int("playback.loop", PLAYBACK_MODE_LOOP_SINGLE);
-			}
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
 
-			deadbeef->sendmessage(DB_EV_CONFIGCHANGED, 0, 0, 0);
-		}
-	} else if (strcmp(propertyName, "Rate") == 0) {
-		debug("Setting the rate is not supported");
-	} else if (strcmp(propertyName, "Shuffle") == 0) {
-		if (g_variant_get_boolean(value)) {
-			deadbeef->conf_set_int("playback.order", PLAYBACK_ORDER_RANDOM);
-		} else {
-			deadbeef->conf_set_int("playback.order", PLAYBACK_ORDER_LINEAR);
-		}
-		deadbeef->sendmessage(DB_EV_CONFIGCHANGED, 0, 0, 0);
-	} else if (strcmp(propertyName, "Volume") == 0) {
-		double volume = g_variant_get_double(value);
-		if (volume > 1.0) {
-			volume = 1.0;
-		} else if (volume < 0.0) {
-			volume = 0.0;
-		}
-		float newVolume = ((float)volume * 50) - 50;
+	debug("get Metadata trackid: %s", trackId);
+	g_variant_builder_add(&builder, "{sv}", "mpris:trackid", g_variant_new("o", trackId));
 
-		deadbeef->volume_set_db(newVolume);
+	debug("get Metadata duration: %" PRId64, duration);
+	if (duration > 0) {
+		g_variant_builder_add(&builder, "{sv}", "mpris:length", g_variant_new("x", duration));
 	}
 
-	return TRUE;
-}
-
-static const GDBusInterfaceVTable playerInterfaceVTable = {
-	onPlayerMethodCallHandler,
-	onPlayerGetPropertyHandler,
-	onPlayerSetPropertyHandler
-};
-
-//***********
-//* SIGNALS *
-//***********
-void emitVolumeChanged(float volume) {
-	GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE_ARRAY);
-	volume = (volume * 0.02) + 1;
-	debug("Volume property changed: %f", volume);
+	if (mprisData->artwork != NULL) {
+		const char *artUri = artCacheLookup(track, mprisData);
 
-	g_variant_builder_add(builder, "{sv}", "Volume", g_variant_new("d", volume));
-	GVariant *signal[] = {
-		g_variant_new_string(PLAYER_INTERFACE),
-		g_variant_builder_end(builder),
-		g_variant_new_strv(NULL, 0)
-	};
+		if (artUri != NULL) {
+			g_variant_builder_add(&builder, "{sv}", "mpris:artUrl", g_variant_new("s", artUri));
+		}
+	}
 
-	g_dbus_connection_emit_signal(globalConnection, NULL, OBJECT_NAME, PROPERTIES_INTERFACE, "PropertiesChanged",
-                                  g_variant_new_tuple(signal, 3), NULL);
+	addMetaFormatFields(&builder, track, fields, deadbeef);
 
-	g_variant_builder_unref(builder);
+	return g_variant_builder_end(&builder);
 }
 
-void emitSeeked(float position) {
-	int64_t positionInMicroseconds = position * 1000000.0;
-	debug("Seeked to %" PRId64, positionInMicroseconds);
-
-	g_dbus_connection_emit_signal(globalConnection, NULL, OBJECT_NAME, PLAYER_INTERFACE, "Seeked",
-                                  g_variant_new("(x)", positionInMicroseconds), NULL);
+// The metadata sent in signals. Leaves out heavy fields in lazy metadata mode.
+GVariant* getMetadataForItem(DB_playItem_t *track, const char *trackId, struct MprisData *mprisData) {
+	return buildMetadata(track, trackId, mprisData->lazyMetadata ? METADATA_LIGHT_FIELDS : METADATA_ALL_FIELDS,
+	                     mprisData);
 }
 
-void emitMetadataChanged(int trackId, struct MprisData *userData) {
-	GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE_ARRAY);
-
-	g_variant_builder_add(builder, "{sv}", "Metadata", getMetadataForTrack(trackId, userData));
-
-	GVariant *signal[] = {
-			g_variant_new_string(PLAYER_INTERFACE),
-			g_variant_builder_end(builder),
-			g_variant_new_strv(NULL, 0)
-	};
-
-	g_dbus_connection_emit_signal(globalConnection, NULL, OBJECT_NAME, PROPERTIES_INTERFACE, "PropertiesChanged",
-                                  g_variant_new_tuple(signal, 3), NULL);
+// Completes light metadata with the heavy fields without evaluating the other fields again
+static GVariant* addHeavyFields(GVariant *metadata, DB_playItem_t *track, DB_functions_t *deadbeef) {
+	GVariantBuilder builder;
+	GVariantIter iter;
+	const char *key;
+	GVariant *value;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+	g_variant_iter_init(&iter, metadata);
+	while (g_variant_iter_next(&iter, "{&sv}", &key, &value)) {
+		g_variant_builder_add(&builder, "{sv}", key, value);
+		g_variant_unref(value);
+	}
+	addMetaFormatFields(&builder, track, METADATA_HEAVY_FIELDS, deadbeef);
 
-	g_variant_builder_unref(builder);
+	return g_variant_builder_end(&builder);
 }
 
-void emitCanGoChanged(struct MprisData *userData) {
-	GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE_ARRAY);
+// Returns a copy of metadata with the current art URI of track, or NULL if metadata already has it
+static GVariant* refreshArtUrl(GVariant *metadata, DB_playItem_t *track, struct MprisData *mprisData) {
+	if (mprisData->artwork == NULL) {
+		return NULL;
+	}
 
-	g_variant_builder_add(builder, "{sv}", "CanPlay", g_variant_new_boolean(deadbeef_hasselectedorplayingtrack(userData, 0)));
-	g_variant_builder_add(builder, "{sv}", "CanGoNext", g_variant_new_boolean(deadbeef_hasselectedorplayingtrack(userData, 1)));
-	g_variant_builder_add(builder, "{sv}", "CanGoPrevious", g_variant_new_boolean(deadbeef_hasselectedorplayingtrack(userData, -1)));
+	const char *artUri = artCacheLookup(track, mprisData);
+	const char *currentArtUri = NULL;
 
-	GVariant *signal[] = {
-			g_variant_new_string(PLAYER_INTERFACE),
-			g_variant_builder_end(builder),
-			g_variant_new_strv(NULL, 0)
-	};
+	g_variant_lookup(metadata, "mpris:artUrl", "&s", &currentArtUri);
+	if (g_strcmp0(artUri, currentArtUri) == 0) {
+		return NULL;
+	}
 
-	g_dbus_connection_emit_signal(globalConnection, NULL, OBJECT_NAME, PROPERTIES_INTERFACE, "PropertiesChanged",
-                                  g_variant_new_tuple(signal, 3), NULL);
+	GVariantBuilder builder;
+	GVariantIter iter;
+	const char *key;
+	GVariant *value;
+
+	debug("Cover changed to %s", artUri);
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+	g_variant_iter_init(&iter, metadata);
+	while (g_variant_iter_next(&iter, "{&sv}", &key, &value)) {
+		if (strcmp(key, "mpris:artUrl") != 0) {
+			g_variant_builder_add(&builder, "{sv}", key, value);
+		}
+		g_variant_unref(value);
+	}
+	if (artUri != NULL) {
+		g_variant_builder_add(&builder, "{sv}", "mpris:artUrl", g_variant_new("s", artUri));
+	}
 
-	g_variant_builder_unref(builder);
+	return g_variant_builder_end(&builder);
 }
 
-void emitPlaybackStatusChanged(int status, struct MprisData *userData) {
-	GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE_ARRAY);
-	DB_functions_t *deadbeef = ((struct MprisData *)userData)->deadbeef;
-
-	switch (status) {
-		case OUTPUT_STATE_PLAYING:
-			g_variant_builder_add(builder, "{sv}", "PlaybackStatus", g_variant_new_string("Playing"));
-			break;
-		case OUTPUT_STATE_PAUSED:
-			g_variant_builder_add(builder, "{sv}", "PlaybackStatus", g_variant_new_string("Paused"));
-			break;
-		case OUTPUT_STATE_STOPPED:
-		default:
-			g_variant_builder_add(builder, "{sv}", "PlaybackStatus", g_variant_new_string("Stopped"));
-			break;
+static void clearFullMetadata(void) {
+	if (cachedFullMetadata != NULL) {
+		g_variant_unref(cachedFullMetadata);
+		cachedFullMetadata = NULL;
 	}
+}
 
-	g_variant_builder_add(builder, "{sv}", "CanSeek", g_variant_new_boolean(deadbeef_can_seek(deadbeef)));
-
-
-	GVariant *signal[] = {
-		g_variant_new_string(PLAYER_INTERFACE),
-		g_variant_builder_end(builder),
-		g_variant_new_strv(NULL, 0)
-	};
+void updateMetadataCache(struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+	DB_playItem_t *track = deadbeef->streamer_get_playing_track();
+	GVariant *metadata = prefetchTake(track, deadbeef);
+
+	if (metadata != NULL) {
+		debug("Using prefetched metadata");
+		// the cover may have finished loading after the prefetch
+		GVariant *refreshed = refreshArtUrl(metadata, track, mprisData);
+		if (refreshed != NULL) {
+			g_variant_unref(metadata);
+			metadata = refreshed;
+		}
+	} else if (track != NULL) {
+		metadata = getMetadataForItem(track, trackIdAcquire(track, deadbeef), mprisData);
+	} else {
+		GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
 
-	g_dbus_connection_emit_signal(globalConnection, NULL, OBJECT_NAME, PROPERTIES_INTERFACE, "PropertiesChanged",
-                                  g_variant_new_tuple(signal, 3), NULL);
+		debug("get Metadata trackid: " NO_TRACK);
+		g_variant_builder_add(builder, "{sv}", "mpris:trackid", g_variant_new("o", NO_TRACK));
+		metadata = g_variant_builder_end(builder);
+		g_variant_builder_unref(builder);
+	}
 
-	g_variant_builder_unref(builder);
+	if (cachedMetadata != NULL) {
+		g_variant_unref(cachedMetadata);
+	}
+	if (cachedTrack != NULL) {
+		trackIdRelease(cachedTrack, deadbeef);
+		deadbeef->pl_item_unref(cachedTrack);
+	}
+	clearFullMetadata();
+	cachedMetadata = g_variant_take_ref(metadata);
+	cachedTrack = track;
+	sharedStateSetMetadata(cachedMetadata);
 }
 
-void emitLoopStatusChanged(int status) {
-	GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE_ARRAY);
-
-	switch (status) {
-	case PLAYBACK_MODE_NOLOOP:
-		g_variant_builder_add(builder, "{sv}", "LoopStatus", g_variant_new_string("None"));
-		break;
-	case PLAYBACK_MODE_LOOP_ALL:
-		g_variant_builder_add(builder, "{sv}", "LoopStatus", g_variant_new_string("Playlist"));
-		break;
-	case PLAYBACK_MODE_LOOP_SINGLE:
-		g_variant_builder_add(builder, "{sv}", "LoopStatus", g_variant_new_string("Track"));
-		break;
-	default:
-		g_variant_builder_add(builder, "{sv}", "LoopStatus", g_variant_new_string("None"));
-		break;
+static GVariant* getCachedMetadata(struct MprisData *mprisData) {
+	if (cachedMetadata == NULL) {
+		debug("Metadata cache is empty, building it");
+		updateMetadataCache(mprisData);
 	}
-	GVariant *signal[] = {
-		g_variant_new_string(PLAYER_INTERFACE),
-		g_variant_builder_end(builder),
-		g_variant_new_strv(NULL, 0)
-	};
 
-	g_dbus_connection_emit_signal(globalConnection, NULL, OBJECT_NAME, PROPERTIES_INTERFACE, "PropertiesChanged",
-                                  g_variant_new_tuple(signal, 3), NULL);
-
-	g_variant_builder_unref(builder);
+	return g_variant_ref(cachedMetadata);
 }
 
-void emitShuffleStatusChanged(int status) {
-	GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE_ARRAY);
+// The metadata returned to clients which read it explicitly
+static GVariant* getCachedFullMetadata(struct MprisData *mprisData) {
+	if (!mprisData->lazyMetadata) {
+		return getCachedMetadata(mprisData);
+	}
 
-	g_variant_builder_add(builder, "{sv}", "Shuffle", g_variant_new_boolean(status != PLAYBACK_ORDER_LINEAR));
-	GVariant *signal[] = {
-		g_variant_new_string(PLAYER_INTERFACE),
-		g_variant_builder_end(builder),
-		g_variant_new_strv(NULL, 0)
-	};
+	if (cachedFullMetadata == NULL) {
+		GVariant *metadata = getCachedMetadata(mprisData);
 
-	g_dbus_connection_emit_signal(globalConnection, NULL, OBJECT_NAME, PROPERTIES_INTERFACE, "PropertiesChanged",
-                                  g_variant_new_tuple(signal, 3), NULL);
+		cachedFullMetadata = cachedTrack != NULL
+				? g_variant_ref_sink(addHeavyFields(metadata, cachedTrack, mprisData->deadbeef))
+				: g_variant_ref(metadata);
+		g_variant_unref(metadata);
+	}
 
-	g_variant_builder_unref(builder);
+	return g_variant_ref(cachedFullMetadata);
 }
 
-static void onBusAcquiredHandler(GDBusConnection *connection, const char *name, void *userData) {
+void freeMetadataCache(DB_functions_t *deadbeef) {
+	clearFullMetadata();
+	if (cachedMetadata != NULL) {
+		g_variant_unref(cachedMetadata);
+		cachedMetadata = NULL;
+	}
+	if (cachedTrack != NULL) {
+		trackIdRelease(cachedTrack, deadbeef);
+		deadbeef->pl_item_unref(cachedTrack);
+		cachedTrack = NULL;
+	}
+}
+
+gboolean deadbeef_can_seek(DB_functions_t *deadbeef) {
+	gboolean can_seek = FALSE;
+	DB_output_t *output = deadbeef->get_output();
+	if (output) {
+		DB_playItem_t *track = deadbeef->streamer_get_playing_track();
+		if (track) {
+			can_seek = deadbeef->pl_get_item_duration(track) > 0;
+			deadbeef->pl_item_unref(track);
+		}
+	}
+	return can_seek;
+}
+
+struct NavigationState {
+	gboolean canPlay;
+	gboolean canGoNext;
+	gboolean canGoPrevious;
+};
+
+// CanPlay, CanGoNext and CanGoPrevious as last computed by emitCanGoChanged, which runs on every event that may
+// change them
+static struct NavigationState cachedNavigation;
+static gboolean navigationValid = FALSE;
+
+// Next/previous of the playing track come from its neighbours in the playlist, which is O(1) unlike looking up its
+// index. Without a playing track the playlist cursor decides. Looping and shuffled orders can always move on as long
+// as there is another track.
+static void getNavigationState(DB_functions_t *deadbeef, DB_playItem_t *playingTrack, struct NavigationState *state) {
+	int order = deadbeef->conf_get_int("playback.order", PLAYBACK_ORDER_LINEAR);
+	int loop = deadbeef->conf_get_int("playback.loop", PLAYBACK_MODE_LOOP_ALL);
+	gboolean wraps = order != PLAYBACK_ORDER_LINEAR || loop == PLAYBACK_MODE_LOOP_ALL;
+	ddb_playlist_t *pl = NULL;
+	int count = 0;
+
+	memset(state, 0, sizeof(*state));
+
+	deadbeef->pl_lock();
+	pl = playingTrack ? deadbeef->plt_get_for_idx(deadbeef->streamer_get_current_playlist()) : deadbeef->plt_get_curr();
+	if (pl) {
+		count = deadbeef->plt_get_item_count(pl, PL_MAIN);
+	}
+
+	if (playingTrack) {
+		state->canPlay = TRUE;
+		if (wraps) {
+			state->canGoNext = state->canGoPrevious = count > 1;
+		} else {
+			DB_playItem_t *next = deadbeef->pl_get_next(playingTrack, PL_MAIN);
+			DB_playItem_t *prev = deadbeef->pl_get_prev(playingTrack, PL_MAIN);
+
+			state->canGoNext = next != NULL;
+			state->canGoPrevious = prev != NULL;
+			if (next) {
+				deadbeef->pl_item_unref(next);
+			}
+			if (prev) {
+				deadbeef->pl_item_unref(prev);
+			}
+		}
+	} else if (pl) {
+		int idx = deadbeef->plt_get_cursor(pl, PL_MAIN);
+
+		state->canPlay = idx >= 0 && idx < count;
+		if (wraps) {
+			state->canGoNext = state->canGoPrevious = count > 1;
+		} else {
+			state->canGoNext = idx + 1 >= 0 && idx + 1 < count;
+			state->canGoPrevious = idx - 1 >= 0 && idx - 1 < count;
+		}
+	}
+
+	if (pl) {
+		deadbeef->plt_unref(pl);
+	}
+	deadbeef->pl_unlock();
+}
+
+static void getCurrentNavigationState(struct MprisData *mprisData, struct NavigationState *state) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+
+	if (!navigationValid) {
+		DB_playItem_t *track = deadbeef->streamer_get_playing_track();
+
+		getNavigationState(deadbeef, track, &cachedNavigation);
+		navigationValid = TRUE;
+		if (track) {
+			deadbeef->pl_item_unref(track);
+		}
+	}
+
+	*state = cachedNavigation;
+}
+
+// Everything the Player interface exposes, read in one go for GetAll
+struct PlayerSnapshot {
+	int playbackState;
+	int loopMode;
+	int playbackOrder;
+	float volume;
+	int64_t position;
+	gboolean canSeek;
+	struct NavigationState navigation;
+};
+
+static void takePlayerSnapshot(struct PlayerSnapshot *snapshot, struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+	DB_output_t *output = deadbeef->get_output();
+	DB_playItem_t *track;
+
+	snapshot->loopMode = deadbeef->conf_get_int("playback.loop", PLAYBACK_MODE_LOOP_ALL);
+	snapshot->playbackOrder = deadbeef->conf_get_int("playback.order", PLAYBACK_ORDER_LINEAR);
+	snapshot->volume = deadbeef->volume_get_db();
+
+	// state, position and CanSeek have to describe the same track
+	deadbeef->pl_lock();
+	track = deadbeef->streamer_get_playing_track();
+	snapshot->playbackState = output != NULL ? output->state() : OUTPUT_STATE_STOPPED;
+	snapshot->position = positionGet(mprisData);
+	snapshot->canSeek = track != NULL && output != NULL && deadbeef->pl_get_item_duration(track) > 0;
+	if (track != NULL) {
+		deadbeef->pl_item_unref(track);
+	}
+	deadbeef->pl_unlock();
+
+	// computed under its own pl_lock
+	getCurrentNavigationState(mprisData, &snapshot->navigation);
+}
+
+static GVariant* newPlaybackStatus(int state) {
+	switch (state) {
+	case OUTPUT_STATE_PLAYING:
+		return g_variant_new_string("Playing");
+	case OUTPUT_STATE_PAUSED:
+		return g_variant_new_string("Paused");
+	case OUTPUT_STATE_STOPPED:
+	default:
+		return g_variant_new_string("Stopped");
+	}
+}
+
+static GVariant* newLoopStatus(int loop) {
+	switch (loop) {
+	case PLAYBACK_MODE_NOLOOP:
+		return g_variant_new_string("None");
+	case PLAYBACK_MODE_LOOP_ALL:
+		return g_variant_new_string("Playlist");
+	case PLAYBACK_MODE_LOOP_SINGLE:
+		return g_variant_new_string("Track");
+	default:
+		return g_variant_new_string("None");
+	}
+}
+
+static GVariant* newVolume(float volumeInDb) {
+	return g_variant_new("d", (volumeInDb * 0.02) + 1);
+}
+
+//************
+//* DISPATCH *
+//************
+// A method call handed to the worker pool
+struct PooledCall {
+	struct MethodRecord *record;
+	GVariant *parameters;
+	GDBusMethodInvocation *invocation;
+};
+
+// name -> record, built once in startServer
+static GHashTable *rootProperties = NULL;
+static GHashTable *rootMethods = NULL;
+static GHashTable *playerProperties = NULL;
+static GHashTable *playerMethods = NULL;
+static GHashTable *trackListMethods = NULL;
+static GHashTable *trackListProperties = NULL;
+static GHashTable *playlistsMethods = NULL;
+static GHashTable *playlistsProperties = NULL;
+static GHashTable *extensionMethods = NULL;
+static GHashTable *statsMethods = NULL;
+static struct StatsCounter *playerGetAllCounter = NULL; // Player has no property handler GDBus would call for GetAll
+static GThreadPool *workerPool = NULL;
+
+static GHashTable* buildPropertyTable(struct PropertyRecord *records, const char *interfaceName) {
+	GHashTable *table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	for (struct PropertyRecord *record = records; record->propertyName; record++) {
+		record->getCounter = record->getterCb ? statsCounter(STATS_GET, interfaceName, record->propertyName) : NULL;
+		record->setCounter = record->setterCb ? statsCounter(STATS_SET, interfaceName, record->propertyName) : NULL;
+		g_hash_table_insert(table, (void *)record->propertyName, record);
+	}
+
+	return table;
+}
+
+static GHashTable* buildMethodTable(struct MethodRecord *records, const char *interfaceName) {
+	GHashTable *table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	for (struct MethodRecord *record = records; record->methodName; record++) {
+		record->counter = statsCounter(STATS_METHOD, interfaceName, record->methodName);
+		g_hash_table_insert(table, (void *)record->methodName, record);
+	}
+
+	return table;
+}
+
+static void dispatchMethodCall(GHashTable *methods, const char *interfaceName, const char *methodName,
+                               GVariant *parameters, GDBusMethodInvocation *invocation, void *userData) {
+	struct MethodRecord *record = g_hash_table_lookup(methods, methodName);
+
+	if (record != NULL && record->pooled && workerPool != NULL) {
+		struct PooledCall *call = g_new(struct PooledCall, 1);
+
+		call->record = record;
+		call->parameters = g_variant_ref(parameters);
+		call->invocation = invocation;
+		g_thread_pool_push(workerPool, call, NULL);
+	} else if (record != NULL) {
+		int64_t begin = statsBegin();
+
+		record->methodCb(parameters, invocation, userData);
+		statsEnd(record->counter, begin);
+	} else {
+		debug("Error! Unsupported method. %s.%s", interfaceName, methodName);
+		g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
+		                                      "Method %s.%s not supported", interfaceName, methodName);
+	}
+}
+
+// Runs on a worker thread. GDBus allows to complete the invocation from any thread.
+static void runPooledCall(void *data, void *userData) {
+	struct PooledCall *call = data;
+	int64_t begin = statsBegin();
+
+	call->record->methodCb(call->parameters, call->invocation, userData);
+	statsEnd(call->record->counter, begin);
+	g_variant_unref(call->parameters);
+	g_free(call);
+}
+
+static GVariant* dispatchGetProperty(GHashTable *properties, const char *propertyName, void *userData) {
+	struct PropertyRecord *record = g_hash_table_lookup(properties, propertyName);
+
+	if (record == NULL || record->getterCb == NULL) {
+		return NULL;
+	}
+
+	if (record->constantValue != NULL) {
+		statsEnd(record->getCounter, statsBegin());
+		return g_variant_ref(record->constantValue);
+	}
+
+	int64_t begin = statsBegin();
+	GVariant *value = record->getterCb(userData);
+	statsEnd(record->getCounter, begin);
+
+	return value;
+}
+
+static void buildConstantValues(struct PropertyRecord *records, struct MprisData *mprisData) {
+	for (struct PropertyRecord *record = records; record->propertyName; record++) {
+		if (record->isConstant) {
+			record->constantValue = g_variant_ref_sink(record->getterCb(mprisData));
+		}
+	}
+}
+
+static void freeConstantValues(struct PropertyRecord *records) {
+	for (struct PropertyRecord *record = records; record->propertyName; record++) {
+		if (record->constantValue != NULL) {
+			g_variant_unref(record->constantValue);
+			record->constantValue = NULL;
+		}
+	}
+}
+
+static gboolean containsString(GPtrArray *strings, const char *str) {
+	for (unsigned int i = 0; i < strings->len; i++) {
+		if (strcmp(g_ptr_array_index(strings, i), str) == 0) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static GVariant* newStringArray(GPtrArray *strings) {
+	return g_variant_new_strv((const char * const *)strings->pdata, strings->len);
+}
+
+static GVariant* newBoolean(gboolean value) {
+	return g_variant_new_boolean(value);
+}
+
+//******************
+//* ROOT INTERFACE *
+//******************
+static void onQuit(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	g_dbus_method_invocation_return_value(invocation, NULL);
+	mprisData->deadbeef->sendmessage(DB_EV_TERMINATE, 0, 0, 0);
+}
+
+static void onRaise(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	GDesktopAppInfo *dskapp = g_desktop_app_info_new ("deadbeef.desktop");
+	if (dskapp) {
+		g_app_info_launch ((GAppInfo *) dskapp, NULL, NULL, NULL);
+		g_object_unref (dskapp);
+	} else {
+		mprisData->deadbeef->sendmessage (DB_EV_ACTIVATED, 0, 0, 0);
+	}
+	g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+static GVariant* getTrue(struct MprisData *mprisData) {
+	return newBoolean(TRUE);
+}
+
+static GVariant* getFalse(struct MprisData *mprisData) {
+	return newBoolean(FALSE);
+}
+
+static GVariant* getIdentity(struct MprisData *mprisData) {
+	return g_variant_new_string("DeaDBeeF");
+}
+
+static GVariant* getDesktopEntry(struct MprisData *mprisData) {
+	return g_variant_new_string("deadbeef");
+}
+
+static GVariant* getSupportedUriSchemes(struct MprisData *mprisData) {
+	GPtrArray *schemes = g_ptr_array_new_with_free_func(g_free);
+	DB_vfs_t **vfsPlugins = mprisData->deadbeef->plug_get_vfs_list();
+
+	g_ptr_array_add(schemes, g_strdup("file"));
+
+	for (int i = 0; vfsPlugins && vfsPlugins[i]; i++) {
+		if (vfsPlugins[i]->get_schemes == NULL) {
+			continue;
+		}
+
+		const char **pluginSchemes = vfsPlugins[i]->get_schemes();
+		for (int j = 0; pluginSchemes && pluginSchemes[j]; j++) {
+			// schemes are given as prefixes like "http://"
+			const char *separator = strstr(pluginSchemes[j], "://");
+			char *scheme = separator ? g_strndup(pluginSchemes[j], separator - pluginSchemes[j]) : g_strdup(pluginSchemes[j]);
+
+			if (*scheme != '\0' && !containsString(schemes, scheme)) {
+				debug("Supported uri scheme: %s", scheme);
+				g_ptr_array_add(schemes, scheme);
+			} else {
+				g_free(scheme);
+			}
+		}
+	}
+
+	GVariant *result = newStringArray(schemes);
+	g_ptr_array_unref(schemes);
+
+	return result;
+}
+
+static void addMimeTypesForExtensions(GPtrArray *mimeTypes, const char **extensions) {
+	for (int i = 0; extensions && extensions[i]; i++) {
+		if (strcmp(extensions[i], "*") == 0) {
+			continue;
+		}
+
+		gboolean uncertain = FALSE;
+		char *fileName = g_strconcat("file.", extensions[i], NULL);
+		char *contentType = g_content_type_guess(fileName, NULL, 0, &uncertain);
+		char *mimeType = contentType && !uncertain ? g_content_type_get_mime_type(contentType) : NULL;
+
+		if (mimeType != NULL && strcmp(mimeType, "application/octet-stream") != 0
+				&& !containsString(mimeTypes, mimeType)) {
+			debug("Supported mime type: %s (%s)", mimeType, extensions[i]);
+			g_ptr_array_add(mimeTypes, mimeType);
+		} else {
+			g_free(mimeType);
+		}
+
+		g_free(contentType);
+		g_free(fileName);
+	}
+}
+
+static GVariant* getSupportedMimeTypes(struct MprisData *mprisData) {
+	GPtrArray *mimeTypes = g_ptr_array_new_with_free_func(g_free);
+	DB_decoder_t **decoders = mprisData->deadbeef->plug_get_decoder_list();
+	DB_playlist_t **playlistPlugins = mprisData->deadbeef->plug_get_playlist_list();
+
+	for (int i = 0; decoders && decoders[i]; i++) {
+		addMimeTypesForExtensions(mimeTypes, decoders[i]->exts);
+	}
+	for (int i = 0; playlistPlugins && playlistPlugins[i]; i++) {
+		addMimeTypesForExtensions(mimeTypes, playlistPlugins[i]->extensions);
+	}
+
+	if (mimeTypes->len == 0) {
+		// no MIME database available, use the MIME types from the .desktop file
+		const char *desktopMimeTypes[] = {
+			"audio/aac", "audio/aacp", "audio/x-it", "audio/x-flac", "audio/x-mod", "audio/mpeg", "audio/x-mpeg",
+			"audio/x-mpegurl", "audio/mp3", "audio/prs.sid", "audio/x-scpls", "audio/x-s3m", "application/ogg",
+			"application/x-ogg", "audio/x-vorbis+ogg", "audio/ogg", "audio/wma", "audio/x-xm"
+		};
+
+		for (unsigned int i = 0; i < G_N_ELEMENTS(desktopMimeTypes); i++) {
+			g_ptr_array_add(mimeTypes, g_strdup(desktopMimeTypes[i]));
+		}
+	}
+
+	GVariant *result = newStringArray(mimeTypes);
+	g_ptr_array_unref(mimeTypes);
+
+	return result;
+}
+
+static struct MethodRecord rootMethodRecords[] = {
+	{ "Quit",  onQuit  },
+	{ "Raise", onRaise },
+	{ NULL             }
+};
+
+struct PropertyRecord rootPropertyRecords[] = {
+	{ "CanQuit",             getTrue,                NULL, TRUE },
+	{ "CanRaise",            getTrue,                NULL, TRUE },
+	{ "HasTrackList",        getTrue,                NULL, TRUE },
+	{ "Identity",            getIdentity,            NULL, TRUE },
+	{ "DesktopEntry",        getDesktopEntry,        NULL, TRUE },
+	{ "SupportedUriSchemes", getSupportedUriSchemes, NULL, TRUE },
+	{ "SupportedMimeTypes",  getSupportedMimeTypes,  NULL, TRUE },
+	{ NULL                                                      }
+};
+
+static void onRootMethodCallHandler(GDBusConnection *connection, const char *sender, const char *objectPath,
+                                    const char *interfaceName, const char *methodName, GVariant *parameters,
+                                    GDBusMethodInvocation *invocation, void *userData) {
+	debug("Method call on root interface. sender: %s, methodName %s", sender, methodName);
+	dispatchMethodCall(rootMethods, interfaceName, methodName, parameters, invocation, userData);
+}
+
+static GVariant* onRootGetPropertyHandler(GDBusConnection *connection, const char *sender, const char *objectPath,
+                                          const char *interfaceName, const char *propertyName, GError **error,
+                                          void *userData) {
+	debug("Get property call on root interface. sender: %s, propertyName: %s", sender, propertyName);
+	return dispatchGetProperty(rootProperties, propertyName, userData);
+}
+
+static const GDBusInterfaceVTable rootInterfaceVTable = {
+	onRootMethodCallHandler,
+	onRootGetPropertyHandler,
+	NULL
+};
+
+//********************
+//* PLAYER INTERFACE *
+//********************
+static void onNext(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	g_dbus_method_invocation_return_value(invocation, NULL);
+	transportNext(mprisData);
+}
+
+static void onPrevious(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	g_dbus_method_invocation_return_value(invocation, NULL);
+	transportPrevious(mprisData);
+}
+
+static void onPause(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	g_dbus_method_invocation_return_value(invocation, NULL);
+	mprisData->deadbeef->sendmessage(DB_EV_PAUSE, 0, 0, 0);
+}
+
+static void onPlayPause(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+
+	g_dbus_method_invocation_return_value(invocation, NULL);
+
+	if (deadbeef->get_output()->state() == OUTPUT_STATE_PLAYING) {
+		deadbeef->sendmessage(DB_EV_PAUSE, 0, 0, 0);
+	} else {
+		deadbeef->sendmessage(DB_EV_PLAY_CURRENT, 0, 0, 0);
+	}
+}
+
+static void onStop(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	g_dbus_method_invocation_return_value(invocation, NULL);
+	mprisData->deadbeef->sendmessage(DB_EV_STOP, 0, 0, 0);
+}
+
+static void onPlay(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+
+	if (deadbeef->get_output()->state() != OUTPUT_STATE_PLAYING)
+		deadbeef->sendmessage(DB_EV_PLAY_CURRENT, 0, 0, 0);
+	g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+static void onSeek(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	int64_t offsetInMicroseconds;
+
+	g_variant_get(parameters, "(x)", &offsetInMicroseconds);
+	g_dbus_method_invocation_return_value(invocation, NULL);
+	transportSeek(offsetInMicroseconds, mprisData);
+}
+
+static void onSetPosition(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+	int64_t position = 0;
+	const char *trackId = NULL;
+
+	g_variant_get(parameters, "(&ox)", &trackId, &position);
+	debug("Set %s position %" PRId64 ".", trackId, position);
+
+	DB_playItem_t *track = deadbeef->streamer_get_playing_track();
+	if (track != NULL) {
+		if (trackIdGetTrack(trackId) == track) {
+			deadbeef->sendmessage(DB_EV_SEEK, 0, position / 1000.0, 0);
+		}
+		deadbeef->pl_item_unref(track);
+	}
+	g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+// Runs on the worker pool. The client gets its reply before the files are added.
+static void onOpenUri(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	const char *uri = NULL;
+
+	g_variant_get(parameters, "(&s)", &uri);
+	debug("OpenUri: %s", uri);
+	g_dbus_method_invocation_return_value(invocation, NULL);
+
+	openUriEnqueue(uri, mprisData);
+}
+
+static GVariant* getPlaybackStatus(struct MprisData *mprisData) {
+	DB_output_t *output = mprisData->deadbeef->get_output();
+
+	return newPlaybackStatus(output != NULL ? output->state() : OUTPUT_STATE_STOPPED);
+}
+
+static GVariant* getLoopStatus(struct MprisData *mprisData) {
+	return newLoopStatus(mprisData->deadbeef->conf_get_int("playback.loop", PLAYBACK_MODE_LOOP_ALL));
+}
+
+static void setLoopStatus(GVariant *value, struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+	const char *status = g_variant_get_string(value, NULL);
+
+	debug("status is %s", status);
+	if (strcmp(status, "None") == 0) {
+		deadbeef->conf_set_int("playback.loop", PLAYBACK_MODE_NOLOOP);
+	} else if (strcmp(status, "Playlist") == 0) {
+		deadbeef->conf_set_int("playback.loop", PLAYBACK_MODE_LOOP_ALL);
+	} else if (strcmp(status, "Track") == 0) {
+		deadbeef->conf_set_int("playback.loop", PLAYBACK_MODE_LOOP_SINGLE);
+	}
+
+	deadbeef->sendmessage(DB_EV_CONFIGCHANGED, 0, 0, 0);
+}
+
+static GVariant* getRate(struct MprisData *mprisData) {
+	return g_variant_new("d", 1.0);
+}
+
+static void setRate(GVariant *value, struct MprisData *mprisData) {
+	debug("Setting the rate is not supported");
+}
+
+static GVariant* getShuffle(struct MprisData *mprisData) {
+	return newBoolean(mprisData->deadbeef->conf_get_int("playback.order", PLAYBACK_ORDER_LINEAR) != PLAYBACK_ORDER_LINEAR);
+}
+
+static void setShuffle(GVariant *value, struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+
+	if (g_variant_get_boolean(value)) {
+		deadbeef->conf_set_int("playback.order", PLAYBACK_ORDER_RANDOM);
+	} else {
+		deadbeef->conf_set_int("playback.order", PLAYBACK_ORDER_LINEAR);
+	}
+	deadbeef->sendmessage(DB_EV_CONFIGCHANGED, 0, 0, 0);
+}
+
+static GVariant* getMetadata(struct MprisData *mprisData) {
+	return getCachedFullMetadata(mprisData);
+}
+
+static GVariant* getVolume(struct MprisData *mprisData) {
+	return newVolume(mprisData->deadbeef->volume_get_db());
+}
+
+static void setVolume(GVariant *value, struct MprisData *mprisData) {
+	double volume = g_variant_get_double(value);
+	if (volume > 1.0) {
+		volume = 1.0;
+	} else if (volume < 0.0) {
+		volume = 0.0;
+	}
+	float newVolume = ((float)volume * 50) - 50;
+
+	mprisData->deadbeef->volume_set_db(newVolume);
+}
+
+static GVariant* getPosition(struct MprisData *mprisData) {
+	return g_variant_new("x", positionGet(mprisData));
+}
+
+static GVariant* getCanGoNext(struct MprisData *mprisData) {
+	struct NavigationState state;
+
+	getCurrentNavigationState(mprisData, &state);
+	return newBoolean(state.canGoNext);
+}
+
+static GVariant* getCanGoPrevious(struct MprisData *mprisData) {
+	struct NavigationState state;
+
+	getCurrentNavigationState(mprisData, &state);
+	return newBoolean(state.canGoPrevious);
+}
+
+static GVariant* getCanPlay(struct MprisData *mprisData) {
+	struct NavigationState state;
+
+	getCurrentNavigationState(mprisData, &state);
+	return newBoolean(state.canPlay);
+}
+
+static GVariant* getCanSeek(struct MprisData *mprisData) {
+	return newBoolean(deadbeef_can_seek(mprisData->deadbeef));
+}
+
+// OpenUri runs on the worker pool, adding files may hit the network or large directories
+static struct MethodRecord playerMethodRecords[] = {
+	{ "Next",        onNext,        FALSE },
+	{ "Previous",    onPrevious,    FALSE },
+	{ "Pause",       onPause,       FALSE },
+	{ "PlayPause",   onPlayPause,   FALSE },
+	{ "Stop",        onStop,        FALSE },
+	{ "Play",        onPlay,        FALSE },
+	{ "Seek",        onSeek,        FALSE },
+	{ "SetPosition", onSetPosition, FALSE },
+	{ "OpenUri",     onOpenUri,     TRUE  },
+	{ NULL                                }
+};
+
+struct PropertyRecord playerPropertyRecords[] = {
+	{ "PlaybackStatus", getPlaybackStatus, NULL,          FALSE },
+	{ "LoopStatus",     getLoopStatus,     setLoopStatus, FALSE },
+	{ "Rate",           getRate,           setRate,       TRUE  },
+	{ "Shuffle",        getShuffle,        setShuffle,    FALSE },
+	{ "Metadata",       getMetadata,       NULL,          FALSE },
+	{ "Volume",         getVolume,         setVolume,     FALSE },
+	{ "Position",       getPosition,       NULL,          FALSE },
+	{ "MinimumRate",    getRate,           NULL,          TRUE  },
+	{ "MaximumRate",    getRate,           NULL,          TRUE  },
+	{ "CanGoNext",      getCanGoNext,      NULL,          FALSE },
+	{ "CanGoPrevious",  getCanGoPrevious,  NULL,          FALSE },
+	{ "CanPlay",        getCanPlay,        NULL,          FALSE },
+	{ "CanPause",       getTrue,           NULL,          TRUE  },
+	{ "CanSeek",        getCanSeek,        NULL,          FALSE },
+	{ "CanControl",     getTrue,           NULL,          TRUE  },
+	{ NULL                                                      }
+};
+
+// Builds all Player properties from a single snapshot instead of resolving the playing track once per property
+GVariant* getAllPlayerProperties(struct MprisData *mprisData) {
+	struct PlayerSnapshot snapshot;
+	GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+	GVariant *metadata = getCachedFullMetadata(mprisData);
+
+	takePlayerSnapshot(&snapshot, mprisData);
+
+	g_variant_builder_add(builder, "{sv}", "PlaybackStatus", newPlaybackStatus(snapshot.playbackState));
+	g_variant_builder_add(builder, "{sv}", "LoopStatus", newLoopStatus(snapshot.loopMode));
+	g_variant_builder_add(builder, "{sv}", "Shuffle", newBoolean(snapshot.playbackOrder != PLAYBACK_ORDER_LINEAR));
+	g_variant_builder_add(builder, "{sv}", "Metadata", metadata);
+	g_variant_builder_add(builder, "{sv}", "Volume", newVolume(snapshot.volume));
+	g_variant_builder_add(builder, "{sv}", "Position", g_variant_new("x", snapshot.position));
+	g_variant_builder_add(builder, "{sv}", "CanGoNext", newBoolean(snapshot.navigation.canGoNext));
+	g_variant_builder_add(builder, "{sv}", "CanGoPrevious", newBoolean(snapshot.navigation.canGoPrevious));
+	g_variant_builder_add(builder, "{sv}", "CanPlay", newBoolean(snapshot.navigation.canPlay));
+	g_variant_builder_add(builder, "{sv}", "CanSeek", newBoolean(snapshot.canSeek));
+
+	for (struct PropertyRecord *record = playerPropertyRecords; record->propertyName; record++) {
+		if (record->constantValue != NULL) {
+			g_variant_builder_add(builder, "{sv}", record->propertyName, record->constantValue);
+		}
+	}
+
+	GVariant *result = g_variant_builder_end(builder);
+	g_variant_builder_unref(builder);
+	g_variant_unref(metadata);
+
+	return result;
+}
+
+// Get and GetAll of the Player interface end up here because the vtable has no get_property handler
+static void onPlayerPropertiesCall(const char *methodName, GVariant *parameters, GDBusMethodInvocation *invocation,
+                                   struct MprisData *mprisData) {
+	if (strcmp(methodName, "GetAll") == 0) {
+		int64_t begin = statsBegin();
+
+		g_dbus_method_invocation_return_value(invocation, g_variant_new("(@a{sv})", getAllPlayerProperties(mprisData)));
+		statsEnd(playerGetAllCounter, begin);
+	} else if (strcmp(methodName, "Get") == 0) {
+		const char *propertyName = NULL;
+
+		g_variant_get(parameters, "(&s&s)", NULL, &propertyName);
+		GVariant *value = dispatchGetProperty(playerProperties, propertyName, mprisData);
+		if (value != NULL) {
+			g_variant_take_ref(value);
+			g_dbus_method_invocation_return_value(invocation, g_variant_new("(v)", value));
+			g_variant_unref(value);
+		} else {
+			g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+			                                      "No such property %s", propertyName);
+		}
+	} else {
+		g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
+		                                      "Method %s.%s not supported", PROPERTIES_INTERFACE, methodName);
+	}
+}
+
+static void onPlayerMethodCallHandler(GDBusConnection *connection, const char *sender, const char *objectPath,
+                                      const char *interfaceName, const char *methodName, GVariant *parameters,
+                                      GDBusMethodInvocation *invocation, void *userData) {
+	debug("Method call on Player interface. sender: %s, methodName %s", sender, methodName);
+	debug("Parameter signature is %s", g_variant_get_type_string (parameters));
+
+	if (strcmp(interfaceName, PROPERTIES_INTERFACE) == 0) {
+		onPlayerPropertiesCall(methodName, parameters, invocation, userData);
+		return;
+	}
+
+	dispatchMethodCall(playerMethods, interfaceName, methodName, parameters, invocation, userData);
+}
+
+#if !GLIB_CHECK_VERSION(2, 38, 0)
+static GVariant* onPlayerGetPropertyHandler(GDBusConnection *connection, const char *sender, const char *objectPath,
+                                            const char *interfaceName, const char *propertyName, GError **error,
+                                            void *userData) {
+	debug("Get property call on Player interface. sender: %s, propertyName: %s", sender, propertyName);
+	return dispatchGetProperty(playerProperties, propertyName, userData);
+}
+#endif
+
+static int onPlayerSetPropertyHandler(GDBusConnection *connection, const char *sender, const char *objectPath,
+                                      const char *interfaceName, const char *propertyName, GVariant *value,
+                                      GError **error, gpointer userData) {
+	debug("Set property call on Player interface. sender: %s, propertyName: %s", sender, propertyName);
+	struct PropertyRecord *record = g_hash_table_lookup(playerProperties, propertyName);
+
+	if (record != NULL && record->setterCb != NULL) {
+		int64_t begin = statsBegin();
+
+		record->setterCb(value, userData);
+		statsEnd(record->setCounter, begin);
+	}
+
+	return TRUE;
+}
+
+static const GDBusInterfaceVTable playerInterfaceVTable = {
+	onPlayerMethodCallHandler,
+#if GLIB_CHECK_VERSION(2, 38, 0)
+	NULL, // Get and GetAll are dispatched to onPlayerMethodCallHandler
+#else
+	onPlayerGetPropertyHandler,
+#endif
+	onPlayerSetPropertyHandler
+};
+
+//***********************
+//* EXTENSION INTERFACE *
+//***********************
+// Metadata with all fields for any known track id, including the ones left out in lazy metadata mode
+static void onGetFullMetadata(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	const char *trackId = NULL;
+	GVariant *metadata;
+
+	g_variant_get(parameters, "(&o)", &trackId);
+	DB_playItem_t *track = trackIdGetTrack(trackId);
+	if (track == NULL) {
+		g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+		                                      "Unknown track id %s", trackId);
+		return;
+	}
+
+	if (track == cachedTrack) {
+		metadata = getCachedFullMetadata(mprisData);
+	} else {
+		metadata = g_variant_ref_sink(buildMetadata(track, trackId, METADATA_ALL_FIELDS, mprisData));
+	}
+
+	g_dbus_method_invocation_return_value(invocation, g_variant_new("(@a{sv})", metadata));
+	g_variant_unref(metadata);
+}
+
+static struct MethodRecord extensionMethodRecords[] = {
+	{ "GetFullMetadata", onGetFullMetadata },
+	{ NULL                                 }
+};
+
+static void onExtensionMethodCallHandler(GDBusConnection *connection, const char *sender, const char *objectPath,
+                                         const char *interfaceName, const char *methodName, GVariant *parameters,
+                                         GDBusMethodInvocation *invocation, void *userData) {
+	debug("Method call on " EXTENSION_INTERFACE " interface. sender: %s, methodName %s", sender, methodName);
+
+	if (strcmp(interfaceName, PROPERTIES_INTERFACE) == 0) { // GetAll, the interface has no properties
+		GVariant *properties = g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0);
+
+		g_dbus_method_invocation_return_value(invocation, g_variant_new("(@a{sv})", properties));
+		return;
+	}
+
+	dispatchMethodCall(extensionMethods, interfaceName, methodName, parameters, invocation, userData);
+}
+
+static const GDBusInterfaceVTable extensionInterfaceVTable = {
+	onExtensionMethodCallHandler,
+	NULL,
+	NULL
+};
+
+//**************************************
+//* TRACKLIST AND PLAYLISTS INTERFACES *
+//**************************************
+// The records live in trackList.c and playlists.c
+static void onTrackListMethodCallHandler(GDBusConnection *connection, const char *sender, const char *objectPath,
+                                         const char *interfaceName, const char *methodName, GVariant *parameters,
+                                         GDBusMethodInvocation *invocation, void *userData) {
+	debug("Method call on TrackList interface. sender: %s, methodName %s", sender, methodName);
+	dispatchMethodCall(trackListMethods, interfaceName, methodName, parameters, invocation, userData);
+}
+
+static GVariant* onTrackListGetPropertyHandler(GDBusConnection *connection, const char *sender,
+                                               const char *objectPath, const char *interfaceName,
+                                               const char *propertyName, GError **error, void *userData) {
+	debug("Get property call on TrackList interface. sender: %s, propertyName: %s", sender, propertyName);
+	return dispatchGetProperty(trackListProperties, propertyName, userData);
+}
+
+static const GDBusInterfaceVTable trackListInterfaceVTable = {
+	onTrackListMethodCallHandler,
+	onTrackListGetPropertyHandler,
+	NULL
+};
+
+static void onPlaylistsMethodCallHandler(GDBusConnection *connection, const char *sender, const char *objectPath,
+                                         const char *interfaceName, const char *methodName, GVariant *parameters,
+                                         GDBusMethodInvocation *invocation, void *userData) {
+	debug("Method call on Playlists interface. sender: %s, methodName %s", sender, methodName);
+	dispatchMethodCall(playlistsMethods, interfaceName, methodName, parameters, invocation, userData);
+}
+
+static GVariant* onPlaylistsGetPropertyHandler(GDBusConnection *connection, const char *sender,
+                                               const char *objectPath, const char *interfaceName,
+                                               const char *propertyName, GError **error, void *userData) {
+	debug("Get property call on Playlists interface. sender: %s, propertyName: %s", sender, propertyName);
+	return dispatchGetProperty(playlistsProperties, propertyName, userData);
+}
+
+static const GDBusInterfaceVTable playlistsInterfaceVTable = {
+	onPlaylistsMethodCallHandler,
+	onPlaylistsGetPropertyHandler,
+	NULL
+};
+
+//*******************
+//* STATS INTERFACE *
+//*******************
+// Call counts and latencies, empty unless mpris2.stats is enabled
+static void onDump(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	g_dbus_method_invocation_return_value(invocation, g_variant_new("(@a(sstttat))", statsDump()));
+}
+
+static struct MethodRecord statsMethodRecords[] = {
+	{ "Dump", onDump },
+	{ NULL           }
+};
+
+static void onStatsMethodCallHandler(GDBusConnection *connection, const char *sender, const char *objectPath,
+                                     const char *interfaceName, const char *methodName, GVariant *parameters,
+                                     GDBusMethodInvocation *invocation, void *userData) {
+	debug("Method call on " STATS_INTERFACE " interface. sender: %s, methodName %s", sender, methodName);
+
+	if (strcmp(interfaceName, PROPERTIES_INTERFACE) == 0) { // GetAll, the interface has no properties
+		GVariant *properties = g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0);
+
+		g_dbus_method_invocation_return_value(invocation, g_variant_new("(@a{sv})", properties));
+		return;
+	}
+
+	dispatchMethodCall(statsMethods, interfaceName, methodName, parameters, invocation, userData);
+}
+
+static const GDBusInterfaceVTable statsInterfaceVTable = {
+	onStatsMethodCallHandler,
+	NULL,
+	NULL
+};
+
+void buildDispatchTables(struct MprisData *mprisData) {
+	rootMethods = buildMethodTable(rootMethodRecords, ROOT_INTERFACE);
+	rootProperties = buildPropertyTable(rootPropertyRecords, ROOT_INTERFACE);
+	playerMethods = buildMethodTable(playerMethodRecords, PLAYER_INTERFACE);
+	playerProperties = buildPropertyTable(playerPropertyRecords, PLAYER_INTERFACE);
+	trackListMethods = buildMethodTable(trackListMethodRecords, TRACKLIST_INTERFACE);
+	trackListProperties = buildPropertyTable(trackListPropertyRecords, TRACKLIST_INTERFACE);
+	playlistsMethods = buildMethodTable(playlistsMethodRecords, PLAYLISTS_INTERFACE);
+	playlistsProperties = buildPropertyTable(playlistsPropertyRecords, PLAYLISTS_INTERFACE);
+	extensionMethods = buildMethodTable(extensionMethodRecords, EXTENSION_INTERFACE);
+	statsMethods = buildMethodTable(statsMethodRecords, STATS_INTERFACE);
+	playerGetAllCounter = statsCounter(STATS_METHOD, PROPERTIES_INTERFACE, "GetAll");
+
+	buildConstantValues(rootPropertyRecords, mprisData);
+	buildConstantValues(playerPropertyRecords, mprisData);
+	buildConstantValues(trackListPropertyRecords, mprisData);
+	buildConstantValues(playlistsPropertyRecords, mprisData);
+}
+
+void freeDispatchTables(void) {
+	freeConstantValues(rootPropertyRecords);
+	freeConstantValues(playerPropertyRecords);
+	freeConstantValues(trackListPropertyRecords);
+	freeConstantValues(playlistsPropertyRecords);
+
+	g_hash_table_unref(rootMethods);
+	g_hash_table_unref(rootProperties);
+	g_hash_table_unref(playerMethods);
+	g_hash_table_unref(playerProperties);
+	g_hash_table_unref(trackListMethods);
+	g_hash_table_unref(trackListProperties);
+	g_hash_table_unref(playlistsMethods);
+	g_hash_table_unref(playlistsProperties);
+	g_hash_table_unref(extensionMethods);
+	g_hash_table_unref(statsMethods);
+}
+
+//***********
+//* SIGNALS *
+//***********
+static gboolean flushPropertyChanges(void *userData) {
+	GHashTable *properties = pendingProperties;
+
+	pendingProperties = NULL;
+	if (flushSource != NULL) {
+		g_source_unref(flushSource);
+		flushSource = NULL;
+	}
+
+	if (properties == NULL) {
+		return G_SOURCE_REMOVE;
+	}
+
+	if (emittedProperties == NULL) {
+		emittedProperties = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_variant_unref);
+	}
+
+	GHashTableIter iter;
+	const char *propertyName;
+	GVariant *value;
+	int changedCount = 0;
+	GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE_ARRAY);
+
+	g_hash_table_iter_init(&iter, properties);
+	while (g_hash_table_iter_next(&iter, (void **)&propertyName, (void **)&value)) {
+		GVariant *emittedValue = g_hash_table_lookup(emittedProperties, propertyName);
+
+		if (emittedValue != NULL && g_variant_equal(emittedValue, value)) {
+			debug("Property %s did not change, not emitting it", propertyName);
+			continue;
+		}
+
+		g_variant_builder_add(builder, "{sv}", propertyName, value);
+		g_hash_table_insert(emittedProperties, g_strdup(propertyName), g_variant_ref(value));
+		changedCount++;
+	}
+
+	if (changedCount > 0) {
+		debug("Emitting PropertiesChanged for %d properties", changedCount);
+		GVariant *signal[] = {
+			g_variant_new_string(PLAYER_INTERFACE),
+			g_variant_builder_end(builder),
+			g_variant_new_strv(NULL, 0)
+		};
+
+		emitSignal(PROPERTIES_INTERFACE, "PropertiesChanged", g_variant_new_tuple(signal, 3));
+	}
+
+	g_variant_builder_unref(builder);
+	g_hash_table_unref(properties);
+
+	return G_SOURCE_REMOVE;
+}
+
+// Sends the pending changes right away instead of waiting for the scheduled flush
+static void flushPropertyChangesNow(void) {
+	if (flushSource != NULL) {
+		g_source_destroy(flushSource);
+	}
+	flushPropertyChanges(NULL);
+}
+
+static void scheduleFlush(void) {
+	if (flushSource != NULL || serverData == NULL) {
+		return;
+	}
+
+	if (serverData->signalDelay > 0) {
+		flushSource = g_timeout_source_new(serverData->signalDelay);
+	} else {
+		flushSource = g_idle_source_new();
+	}
+	g_source_set_callback(flushSource, flushPropertyChanges, NULL, NULL);
+	g_source_attach(flushSource, serverData->context);
+}
+
+// Takes ownership of a floating value, otherwise a new reference is taken.
+static void queuePropertyChange(const char *propertyName, GVariant *value) {
+	g_variant_ref_sink(value);
+
+	if (pendingProperties == NULL) {
+		pendingProperties = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_variant_unref);
+	}
+	g_hash_table_insert(pendingProperties, g_strdup(propertyName), value);
+	scheduleFlush();
+}
+
+void freePropertyChanges(void) {
+	if (flushSource != NULL) {
+		g_source_destroy(flushSource);
+		g_source_unref(flushSource);
+		flushSource = NULL;
+	}
+	if (pendingProperties != NULL) {
+		g_hash_table_unref(pendingProperties);
+		pendingProperties = NULL;
+	}
+
+	if (emittedProperties != NULL) {
+		g_hash_table_unref(emittedProperties);
+		emittedProperties = NULL;
+	}
+}
+
+void emitVolumeChanged(float volume) {
+	debug("Volume property changed: %f", volume);
+
+	sharedStateSetVolume(volume);
+	queuePropertyChange("Volume", newVolume(volume));
+}
+
+// Emits on the bus and to every peer connection
+void emitSignal(const char *interfaceName, const char *signalName, GVariant *parameters) {
+	int64_t begin = statsBegin();
+
+	g_variant_ref_sink(parameters);
+	if (globalConnection != NULL) {
+		g_dbus_connection_emit_signal(globalConnection, NULL, OBJECT_NAME, interfaceName, signalName, parameters,
+		                              NULL);
+	}
+	for (GSList *peer = peerConnections; peer != NULL; peer = peer->next) {
+		g_dbus_connection_emit_signal(peer->data, NULL, OBJECT_NAME, interfaceName, signalName, parameters, NULL);
+	}
+	g_variant_unref(parameters);
+
+	statsEnd(statsCounter(STATS_SIGNAL, interfaceName, signalName), begin);
+}
+
+void emitSeeked(float position) {
+	int64_t positionInMicroseconds = position * 1000000.0;
+	debug("Seeked to %" PRId64, positionInMicroseconds);
+
+	// a pending Metadata change announces the track the position belongs to, so it has to go out first
+	flushPropertyChangesNow();
+	emitSignal(PLAYER_INTERFACE, "Seeked", g_variant_new("(x)", positionInMicroseconds));
+}
+
+void emitMetadataChanged(struct MprisData *userData) {
+	updateMetadataCache(userData);
+
+	GVariant *metadata = getCachedMetadata(userData);
+	queuePropertyChange("Metadata", metadata);
+	g_variant_unref(metadata);
+}
+
+// Whether the track is the one Metadata describes or the one playing right now
+gboolean isCurrentTrack(DB_playItem_t *track, struct MprisData *mprisData) {
+	DB_playItem_t *playingTrack = mprisData->deadbeef->streamer_get_playing_track();
+	gboolean current = track == cachedTrack || track == playingTrack;
+
+	if (playingTrack != NULL) {
+		mprisData->deadbeef->pl_item_unref(playingTrack);
+	}
+
+	return current;
+}
+
+// Only the cover of the playing track changed, patch it into the cached metadata instead of rebuilding it
+void emitArtworkChanged(struct MprisData *userData) {
+	if (cachedMetadata == NULL || cachedTrack == NULL) {
+		return;
+	}
+
+	GVariant *metadata = refreshArtUrl(cachedMetadata, cachedTrack, userData);
+	if (metadata == NULL) {
+		return;
+	}
+
+	g_variant_unref(cachedMetadata);
+	clearFullMetadata();
+	cachedMetadata = g_variant_ref_sink(metadata);
+	sharedStateSetMetadata(cachedMetadata);
+	queuePropertyChange("Metadata", cachedMetadata);
+}
+
+// Recomputes the navigation flags and queues only the ones which flipped
+void emitCanGoChanged(struct MprisData *userData) {
+	struct NavigationState previous = cachedNavigation;
+	gboolean wasValid = navigationValid;
+	struct NavigationState state;
+
+	navigationValid = FALSE;
+	getCurrentNavigationState(userData, &state);
+
+	if (!wasValid || state.canPlay != previous.canPlay) {
+		queuePropertyChange("CanPlay", newBoolean(state.canPlay));
+	}
+	if (!wasValid || state.canGoNext != previous.canGoNext) {
+		queuePropertyChange("CanGoNext", newBoolean(state.canGoNext));
+	}
+	if (!wasValid || state.canGoPrevious != previous.canGoPrevious) {
+		queuePropertyChange("CanGoPrevious", newBoolean(state.canGoPrevious));
+	}
+}
+
+void emitPlaybackStatusChanged(int status, struct MprisData *userData) {
+	DB_functions_t *deadbeef = ((struct MprisData *)userData)->deadbeef;
+
+	sharedStateSetPlaybackStatus(status);
+	queuePropertyChange("PlaybackStatus", newPlaybackStatus(status));
+	queuePropertyChange("CanSeek", g_variant_new_boolean(deadbeef_can_seek(deadbeef)));
+}
+
+void emitLoopStatusChanged(int status) {
+	sharedStateSetLoopMode(status);
+	queuePropertyChange("LoopStatus", newLoopStatus(status));
+}
+
+void emitShuffleStatusChanged(int status) {
+	sharedStateSetPlaybackOrder(status);
+	queuePropertyChange("Shuffle", g_variant_new_boolean(status != PLAYBACK_ORDER_LINEAR));
+}
+
+// Fills the shared state block with everything the emit functions would otherwise only update on the next change
+static void publishSharedState(struct MprisData *mprisData) {
+	struct PlayerSnapshot snapshot;
+
+	sharedStateOpen();
+	takePlayerSnapshot(&snapshot, mprisData);
+	sharedStateSetPlaybackStatus(snapshot.playbackState);
+	sharedStateSetLoopMode(snapshot.loopMode);
+	sharedStateSetPlaybackOrder(snapshot.playbackOrder);
+	sharedStateSetVolume(snapshot.volume);
+	g_variant_unref(getCachedMetadata(mprisData));
+}
+
+static void onBusAcquiredHandler(GDBusConnection *connection, const char *name, void *userData) {
 	globalConnection = connection;
 	debug("Bus accquired");
 }
 
-static void onNameAcquiredHandler(GDBusConnection *connection, const char *name, void *userData) {
-	debug("name accquired: %s", name);
-	GDBusInterfaceInfo **interfaces = ((struct MprisData*)userData)->gdbusNodeInfo->interfaces;
+// In the order of the interfaces in xmlForNode
+static const GDBusInterfaceVTable *interfaceVTables[] = {
+	&rootInterfaceVTable,
+	&playerInterfaceVTable,
+	&trackListInterfaceVTable,
+	&playlistsInterfaceVTable,
+	&extensionInterfaceVTable,
+	&statsInterfaceVTable,
+	NULL
+};
+
+static void registerObjects(GDBusConnection *connection, struct MprisData *mprisData) {
+	GDBusInterfaceInfo **interfaces = mprisData->gdbusNodeInfo->interfaces;
 
 	debug("Registering" OBJECT_NAME "object...");
-	g_dbus_connection_register_object(connection, OBJECT_NAME, interfaces[0], &rootInterfaceVTable, userData, NULL,
-                                      NULL);
+	for (int i = 0; interfaceVTables[i] != NULL; i++) {
+		g_dbus_connection_register_object(connection, OBJECT_NAME, interfaces[i], interfaceVTables[i], mprisData,
+		                                  NULL, NULL);
+	}
+}
 
-	g_dbus_connection_register_object(connection, OBJECT_NAME, interfaces[1], &playerInterfaceVTable, userData, NULL,
-                                      NULL);
+static void onNameAcquiredHandler(GDBusConnection *connection, const char *name, void *userData) {
+	debug("name accquired: %s", name);
+
+	registerObjects(connection, userData);
+	trackListUpdatePlaylist(userData);
 }
 
 static void onConnotConnectToBus(GDBusConnection *connection, const char *name, void *user_data){
 	error("cannot connect to bus");
 }
 
+// The plugin uses its own connection instead of the process wide session bus connection, so it neither competes
+// with other users of that connection nor leaves objects registered on it when the plugin stops
+static GDBusConnection *ownConnection = NULL;
+static GCancellable *connecting = NULL;
+static unsigned int ownerId = 0;
+
+static void onConnected(GObject *source, GAsyncResult *result, void *userData) {
+	GError *connectError = NULL;
+	GDBusConnection *connection = g_dbus_connection_new_for_address_finish(result, &connectError);
+
+	if (connection == NULL) {
+		if (!g_error_matches(connectError, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			error("cannot connect to bus: %s", connectError->message);
+		}
+		g_error_free(connectError);
+		return;
+	}
+
+	ownConnection = connection;
+	onBusAcquiredHandler(connection, BUS_NAME, userData);
+	ownerId = g_bus_own_name_on_connection(connection, BUS_NAME, G_BUS_NAME_OWNER_FLAGS_REPLACE,
+	                                       onNameAcquiredHandler, onConnotConnectToBus, userData, NULL);
+}
+
+static void connectToBus(struct MprisData *mprisData) {
+	GError *addressError = NULL;
+	char *address = g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SESSION, NULL, &addressError);
+
+	if (address == NULL) {
+		error("cannot connect to bus: %s", addressError->message);
+		g_error_free(addressError);
+		return;
+	}
+
+	connecting = g_cancellable_new();
+	g_dbus_connection_new_for_address(address, G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT
+	                                  | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION, NULL, connecting,
+	                                  onConnected, mprisData);
+	g_free(address);
+}
+
+static void disconnectFromBus(void) {
+	g_cancellable_cancel(connecting);
+	g_clear_object(&connecting);
+
+	if (ownerId != 0) {
+		g_bus_unown_name(ownerId);
+		ownerId = 0;
+	}
+	globalConnection = NULL;
+	if (ownConnection != NULL) {
+		g_dbus_connection_close_sync(ownConnection, NULL, NULL);
+		g_object_unref(ownConnection);
+		ownConnection = NULL;
+	}
+}
+
+static gboolean onAuthorizePeer(GDBusAuthObserver *observer, GIOStream *stream, GCredentials *credentials,
+                                void *userData) {
+	if (credentials == NULL) {
+		debug("Rejecting peer without credentials");
+		return FALSE;
+	}
+
+	uid_t uid = g_credentials_get_unix_user(credentials, NULL);
+	if (uid != getuid()) {
+		debug("Rejecting peer of user %u", (unsigned int)uid);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void onPeerClosed(GDBusConnection *connection, gboolean remotePeerVanished, GError *closeError, void *userData) {
+	debug("Peer disconnected");
+	peerConnections = g_slist_remove(peerConnections, connection);
+	g_object_unref(connection);
+}
+
+static gboolean onPeerConnected(GDBusServer *server, GDBusConnection *connection, void *userData) {
+	debug("Peer connected");
+	registerObjects(connection, userData);
+	g_signal_connect(connection, "closed", G_CALLBACK(onPeerClosed), NULL);
+	peerConnections = g_slist_prepend(peerConnections, g_object_ref(connection));
+
+	return TRUE;
+}
+
+// A socket nobody listens on any more refuses connections
+static gboolean isStaleSocket(const char *path) {
+	struct sockaddr_un socketAddress = { .sun_family = AF_UNIX };
+	gboolean stale = FALSE;
+	int fd;
+
+	if (strlen(path) >= sizeof(socketAddress.sun_path) || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		return FALSE;
+	}
+
+	g_strlcpy(socketAddress.sun_path, path, sizeof(socketAddress.sun_path));
+	if (connect(fd, (struct sockaddr *)&socketAddress, sizeof(socketAddress)) < 0) {
+		stale = errno == ECONNREFUSED;
+	}
+	close(fd);
+
+	return stale;
+}
+
+static void startPeerServer(struct MprisData *mprisData) {
+	char *path = g_build_filename(g_get_user_runtime_dir(), PEER_SOCKET_NAME, NULL);
+
+	if (g_file_test(path, G_FILE_TEST_EXISTS)) {
+		if (!isStaleSocket(path)) {
+			error("%s is in use by another instance, not listening for peers", path);
+			g_free(path);
+			return;
+		}
+		// left behind if DeaDBeeF crashed
+		g_unlink(path);
+	}
+
+	char *address = g_strconcat("unix:path=", path, NULL);
+	char *guid = g_dbus_generate_guid();
+	GDBusAuthObserver *observer = g_dbus_auth_observer_new();
+	GError *serverError = NULL;
+
+	g_signal_connect(observer, "authorize-authenticated-peer", G_CALLBACK(onAuthorizePeer), NULL);
+	peerServer = g_dbus_server_new_sync(address, G_DBUS_SERVER_FLAGS_NONE, guid, observer, NULL, &serverError);
+	if (peerServer != NULL) {
+		g_signal_connect(peerServer, "new-connection", G_CALLBACK(onPeerConnected), mprisData);
+		g_dbus_server_start(peerServer);
+		debug("Listening for peers on %s", g_dbus_server_get_client_address(peerServer));
+	} else {
+		error("cannot listen on %s: %s", path, serverError->message);
+		g_error_free(serverError);
+	}
+
+	g_object_unref(observer);
+	g_free(guid);
+	g_free(address);
+	g_free(path);
+}
+
+static void stopPeerServer(void) {
+	if (peerServer != NULL) {
+		g_dbus_server_stop(peerServer);
+		g_object_unref(peerServer);
+		peerServer = NULL;
+	}
+
+	while (peerConnections != NULL) {
+		GDBusConnection *connection = peerConnections->data;
+
+		peerConnections = g_slist_delete_link(peerConnections, peerConnections);
+		g_signal_handlers_disconnect_by_func(connection, onPeerClosed, NULL);
+		g_dbus_connection_close_sync(connection, NULL, NULL);
+		g_object_unref(connection);
+	}
+}
+
 void* startServer(void *data) {
-	int ownerId;
-	GMainContext *context = g_main_context_new();
 	struct MprisData *mprisData = data;
-
+	GMainContext *context = mprisData->context;
 
 	g_main_context_push_thread_default(context);
+	serverData = mprisData;
+	statsInit(mprisData->stats);
+	buildDispatchTables(mprisData);
+	if (mprisData->sharedState) {
+		publishSharedState(mprisData);
+	}
 
 	mprisData->gdbusNodeInfo = g_dbus_node_info_new_for_xml(xmlForNode, NULL);
+	workerPool = g_thread_pool_new(runPooledCall, mprisData, WORKER_THREADS, FALSE, NULL);
 
-	ownerId = g_bus_own_name(G_BUS_TYPE_SESSION, BUS_NAME, G_BUS_NAME_OWNER_FLAGS_REPLACE,
-                             onBusAcquiredHandler, onNameAcquiredHandler, onConnotConnectToBus,
-                             (void *)mprisData, NULL);
+	connectToBus(mprisData);
+	if (mprisData->peerSocket) {
+		startPeerServer(mprisData);
+	}
 
 	loop = g_main_loop_new(context, FALSE);
 	g_main_loop_run(loop);
 
-	g_bus_unown_name(ownerId);
+	// pending calls still get their reply before the connection goes away
+	g_thread_pool_free(workerPool, FALSE, TRUE);
+	workerPool = NULL;
+	openUriFree();
+	stopPeerServer();
+	disconnectFromBus();
 	g_dbus_node_info_unref(mprisData->gdbusNodeInfo);
 	g_main_loop_unref(loop);
 
-	freeTfBytecode(mprisData->deadbeef);
+	freePropertyChanges();
+	freeDispatchTables();
+	trackListFree(mprisData);
+	playlistsFree(mprisData);
+	navigationValid = FALSE;
+	serverData = NULL;
+	g_main_context_pop_thread_default(context);
+
+	prefetchFree(mprisData->deadbeef);
+	positionFree(mprisData->deadbeef);
+	transportFree(mprisData->deadbeef);
+	sharedStateClose();
+	freeMetadataCache(mprisData->deadbeef);
+	artCacheFree();
+	trackIdFreeAll(mprisData->deadbeef);
+	freeMetaFormats(mprisData->deadbeef);
+	statsFree(mprisData->statsFile);
 
 	return 0;
 }
 
-void stopServer() {
-	debug("Stopping...");
+static gboolean onStopRequested(void *userData) {
 	g_main_loop_quit(loop);
+
+	return G_SOURCE_REMOVE;
+}
+
+// The loop may not exist yet while startServer is still connecting, so the quit is queued on the context and runs
+// once the loop does
+void stopServer(struct MprisData *mprisData) {
+	GSource *source = g_idle_source_new();
+
+	debug("Stopping...");
+	g_source_set_priority(source, G_PRIORITY_HIGH);
+	g_source_set_callback(source, onStopRequested, NULL, NULL);
+	g_source_attach(source, mprisData->context);
+	g_source_unref(source);
+}
+
+// Other threads hand work to the mpris main context with invokeOnServer. Once the context is closed that work is
+// dropped instead of ending up on a context nobody iterates any more.
+static GMutex invokeMutex;
+static GMainContext *invokeContext = NULL;
+
+void openServerContext(GMainContext *context) {
+	g_mutex_lock(&invokeMutex);
+	invokeContext = context;
+	g_mutex_unlock(&invokeMutex);
+}
+
+void closeServerContext(void) {
+	g_mutex_lock(&invokeMutex);
+	invokeContext = NULL;
+	g_mutex_unlock(&invokeMutex);
+}
+
+// Queues callback on the mpris main context, or frees data and returns FALSE if the context is closed. Unlike
+// g_main_context_invoke_full it never runs callback on the calling thread.
+gboolean invokeOnServer(GSourceFunc callback, void *data, GDestroyNotify notify) {
+	GSource *source;
+
+	g_mutex_lock(&invokeMutex);
+	if (invokeContext == NULL) {
+		g_mutex_unlock(&invokeMutex);
+		notify(data);
+		return FALSE;
+	}
+
+	// attached under the lock, closeServerContext waits for it and the context is only freed after that
+	source = g_idle_source_new();
+	g_source_set_priority(source, G_PRIORITY_DEFAULT);
+	g_source_set_callback(source, callback, data, notify);
+	g_source_attach(source, invokeContext);
+	g_mutex_unlock(&invokeMutex);
+
+	g_source_unref(source);
+	return TRUE;
 }
@@ -1,6 +1,8 @@
 #ifndef MPRISSERVER_H_
 #define MPRISSERVER_H_
 
+#include <limits.h>
+
 #include <gio/gio.h>
 #include <gio/gdesktopappinfo.h>
 
@@ -9,27 +11,92 @@
 #include <deadbeef/deadbeef.h>
 #include "artwork.h"
 
+#define OBJECT_NAME "/org/mpris/MediaPlayer2"
+#define ROOT_INTERFACE "org.mpris.MediaPlayer2"
+#define PLAYER_INTERFACE "org.mpris.MediaPlayer2.Player"
+#define TRACKLIST_INTERFACE "org.mpris.MediaPlayer2.TrackList"
+#define PLAYLISTS_INTERFACE "org.mpris.MediaPlayer2.Playlists"
+#define PROPERTIES_INTERFACE "org.freedesktop.DBus.Properties"
+#define EXTENSION_INTERFACE "org.deadbeef.Mpris"
+#define STATS_INTERFACE "org.deadbeef.MprisStats"
+#define NO_TRACK "/org/mpris/MediaPlayer2/TrackList/NoTrack"
+
 #define SETTING_PREVIOUS_ACTION "mpris2.previous_action"
 #define PREVIOUS_ACTION_PREVIOUS 0
 #define PREVIOUS_ACTION_PREV_OR_RESTART 1
+#define SETTING_SIGNAL_DELAY "mpris2.signal_delay"
+#define SETTING_PREFETCH_TIME "mpris2.prefetch_time"
+#define DEFAULT_PREFETCH_TIME 5
+#define SETTING_FIELD_PREFIX "mpris2.field."
+#define SETTING_LAZY_METADATA "mpris2.lazy_metadata"
+#define SETTING_STATS "mpris2.stats"
+#define SETTING_STATS_FILE "mpris2.stats_file"
+#define SETTING_LOG_LEVEL "mpris2.log_level"
+#define SETTING_LOG_JSON "mpris2.log_json"
+#define SETTING_OPEN_URI_PLAYLIST "mpris2.open_uri_playlist"
+#define SETTING_SHARED_STATE "mpris2.shared_state"
+#define SETTING_PEER_SOCKET "mpris2.peer_socket"
 
 struct MprisData {
 	DB_functions_t *deadbeef;
 	DB_artwork_plugin_t *artwork;
 	DB_plugin_action_t *prevOrRestart;
 	GDBusNodeInfo *gdbusNodeInfo;
+	GMainContext *context;
 	int previousAction;
+	int signalDelay;
+	int prefetchTime;
+	int lazyMetadata;
+	int stats;
+	int sharedState;
+	int peerSocket;
+	char statsFile[PATH_MAX];
+};
+
+struct StatsCounter;
+
+typedef GVariant* (*PropertyGetterCb)(struct MprisData *mprisData);
+typedef void (*PropertySetterCb)(GVariant *value, struct MprisData *mprisData);
+typedef void (*MethodCb)(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData);
+
+// Dispatch table entries of an interface, looked up by name in tables built once in startServer
+struct PropertyRecord {
+	const char *propertyName;
+	const PropertyGetterCb getterCb;
+	const PropertySetterCb setterCb;
+	const gboolean isConstant;
+	GVariant *constantValue; // built once in startServer if isConstant
+	struct StatsCounter *getCounter; // resolved once in startServer, NULL without call statistics
+	struct StatsCounter *setCounter;
+};
+
+struct MethodRecord {
+	const char *methodName;
+	const MethodCb methodCb;
+	const gboolean pooled; // runs on the worker pool, so it must not touch anything of the mpris main context
+	struct StatsCounter *counter; // resolved once in startServer, NULL without call statistics
 };
 
+gboolean loadMetaFormats(DB_functions_t*);
 void* startServer(void*);
-void stopServer(void);
+void stopServer(struct MprisData*);
+void openServerContext(GMainContext*);
+void closeServerContext(void);
+gboolean invokeOnServer(GSourceFunc, void*, GDestroyNotify);
+
+GVariant* getMetadataForItem(DB_playItem_t*, const char*, struct MprisData*);
+void updateMetadataCache(struct MprisData*);
+
+void emitSignal(const char*, const char*, GVariant*);
 
 void emitVolumeChanged(float);
 void emitSeeked(float);
-void emitMetadataChanged(int, struct MprisData*);
+void emitMetadataChanged(struct MprisData*);
+gboolean isCurrentTrack(DB_playItem_t*, struct MprisData*);
 void emitPlaybackStatusChanged(int, struct MprisData*);
 void emitLoopStatusChanged(int);
 void emitShuffleStatusChanged(int);
 void emitCanGoChanged(struct MprisData *);
+void emitArtworkChanged(struct MprisData *);
 
 #endif
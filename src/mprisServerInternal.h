@@ -0,0 +1,18 @@
+#ifndef MPRISSERVERINTERNAL_H_
+#define MPRISSERVERINTERNAL_H_
+
+#include "mprisServer.h"
+
+// Parts of the server which are not used by the rest of the plugin, only exposed for bench/mprisBench.c
+extern struct MprisData *serverData;
+extern struct PropertyRecord rootPropertyRecords[];
+extern struct PropertyRecord playerPropertyRecords[];
+
+void freeMetaFormats(DB_functions_t*);
+void freeMetadataCache(DB_functions_t*);
+GVariant* getAllPlayerProperties(struct MprisData*);
+void buildDispatchTables(struct MprisData*);
+void freeDispatchTables(void);
+void freePropertyChanges(void);
+
+#endif
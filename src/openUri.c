@@ -0,0 +1,119 @@
+#include <string.h>
+
+#include <glib.h>
+
+#include "logging.h"
+#include "openUri.h"
+
+#define MAX_TITLE_LENGTH 1000
+
+// URIs of OpenUri calls which were answered but not added yet. The first caller which finds no batch running
+// adds everything queued in one plt_add_files_begin/end session and repeats until the queue is empty, so only one
+// thread adds files at a time while the others return right away.
+static GMutex queueMutex;
+static GPtrArray *queue = NULL;
+static gboolean adding = FALSE;
+
+// Returns the playlist named by SETTING_OPEN_URI_PLAYLIST, creating it if needed, or the current playlist
+static ddb_playlist_t* getTargetPlaylist(DB_functions_t *deadbeef) {
+	char name[MAX_TITLE_LENGTH];
+	char title[MAX_TITLE_LENGTH];
+
+	deadbeef->conf_get_str(SETTING_OPEN_URI_PLAYLIST, "", name, sizeof(name));
+	if (name[0] == '\0') {
+		return deadbeef->plt_get_curr();
+	}
+
+	int count = deadbeef->plt_get_count();
+	for (int i = 0; i < count; i++) {
+		ddb_playlist_t *pl = deadbeef->plt_get_for_idx(i);
+
+		if (pl == NULL) {
+			continue;
+		}
+		deadbeef->plt_get_title(pl, title, sizeof(title));
+		if (strcmp(title, name) == 0) {
+			return pl;
+		}
+		deadbeef->plt_unref(pl);
+	}
+
+	debug("Creating playlist %s for OpenUri", name);
+	return deadbeef->plt_get_for_idx(deadbeef->plt_add(count, name));
+}
+
+// Appends the URIs to the target playlist and plays the first track of the last one
+static void addUris(GPtrArray *uris, DB_functions_t *deadbeef) {
+	ddb_playlist_t *pl = getTargetPlaylist(deadbeef);
+	int playIndex = -1;
+
+	if (pl == NULL) {
+		error("OpenUri: no playlist to add %u URIs to", uris->len);
+		return;
+	}
+
+	// a running session of someone else, the files are still added, just without batching
+	gboolean batched = deadbeef->plt_add_files_begin(pl, 0) == 0;
+	for (unsigned int i = 0; i < uris->len; i++) {
+		const char *uri = g_ptr_array_index(uris, i);
+		int count = deadbeef->plt_get_item_count(pl, PL_MAIN);
+		DB_playItem_t *last = deadbeef->plt_get_last(pl, PL_MAIN);
+
+		if (deadbeef->plt_insert_file2(0, pl, last, uri, NULL, NULL, NULL) == NULL) {
+			error("OpenUri: cannot add %s", uri);
+		}
+		if (last != NULL) {
+			deadbeef->pl_item_unref(last);
+		}
+
+		// appended at the end, so the new tracks start at the former count
+		if (deadbeef->plt_get_item_count(pl, PL_MAIN) > count) {
+			playIndex = count;
+		}
+	}
+	if (batched) {
+		deadbeef->plt_add_files_end(pl, 0);
+	}
+
+	if (playIndex >= 0) {
+		deadbeef->plt_set_curr(pl);
+		deadbeef->sendmessage(DB_EV_PLAY_NUM, 0, playIndex, 0);
+	}
+	deadbeef->plt_unref(pl);
+}
+
+// Queues the URI. Blocks while adding if no other thread is, so call it after replying to the method call.
+void openUriEnqueue(const char *uri, struct MprisData *mprisData) {
+	g_mutex_lock(&queueMutex);
+	if (queue == NULL) {
+		queue = g_ptr_array_new_with_free_func(g_free);
+	}
+	g_ptr_array_add(queue, g_strdup(uri));
+	if (adding) {
+		g_mutex_unlock(&queueMutex);
+		return;
+	}
+
+	adding = TRUE;
+	while (queue->len > 0) {
+		GPtrArray *uris = queue;
+
+		queue = g_ptr_array_new_with_free_func(g_free);
+		g_mutex_unlock(&queueMutex);
+
+		debug("OpenUri: adding %u URIs", uris->len);
+		addUris(uris, mprisData->deadbeef);
+		g_ptr_array_unref(uris);
+
+		g_mutex_lock(&queueMutex);
+	}
+	adding = FALSE;
+	g_mutex_unlock(&queueMutex);
+}
+
+void openUriFree(void) {
+	if (queue != NULL) {
+		g_ptr_array_unref(queue);
+		queue = NULL;
+	}
+}
@@ -0,0 +1,9 @@
+#ifndef OPENURI_H_
+#define OPENURI_H_
+
+#include "mprisServer.h"
+
+void openUriEnqueue(const char*, struct MprisData*);
+void openUriFree(void);
+
+#endif
@@ -0,0 +1,326 @@
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "logging.h"
+#include "playlists.h"
+
+#define PLAYLIST_ID_PREFIX "/DeaDBeeF/Playlist/"
+#define NO_PLAYLIST "/"
+#define ORDERING_ALPHABETICAL "Alphabetical"
+#define ORDERING_USER_DEFINED "UserDefined"
+
+struct PlaylistEntry {
+	ddb_playlist_t *playlist;
+	char *playlistId;
+	char *title;
+	char *titleCollateKey;
+	unsigned int generation;
+};
+
+// Cached view of DeaDBeeF's playlists in tab order. It is only refreshed from playlist events, GetPlaylists just
+// slices it. The alphabetical view is sorted on first use after a change.
+// Only accessed from the mpris main context.
+static GPtrArray *playlists = NULL;
+static GPtrArray *alphabeticalPlaylists = NULL;
+static GHashTable *entriesByPlaylist = NULL;
+static GHashTable *entriesById = NULL;
+static ddb_playlist_t *activePlaylist = NULL;
+static unsigned int generation = 0;
+static guint64 nextPlaylistId = 0;
+
+static void setTitle(struct PlaylistEntry *entry, const char *title) {
+	g_free(entry->title);
+	g_free(entry->titleCollateKey);
+	entry->title = g_strdup(title);
+	entry->titleCollateKey = g_utf8_collate_key(title, -1);
+}
+
+static void freeEntry(struct PlaylistEntry *entry, DB_functions_t *deadbeef) {
+	g_hash_table_remove(entriesByPlaylist, entry->playlist);
+	g_hash_table_remove(entriesById, entry->playlistId);
+
+	deadbeef->plt_unref(entry->playlist);
+	g_free(entry->playlistId);
+	g_free(entry->title);
+	g_free(entry->titleCollateKey);
+	g_free(entry);
+}
+
+static void invalidateAlphabeticalPlaylists(void) {
+	if (alphabeticalPlaylists != NULL) {
+		g_ptr_array_unref(alphabeticalPlaylists);
+		alphabeticalPlaylists = NULL;
+	}
+}
+
+static int compareTitles(const void *a, const void *b) {
+	const struct PlaylistEntry *entryA = *(struct PlaylistEntry * const *)a;
+	const struct PlaylistEntry *entryB = *(struct PlaylistEntry * const *)b;
+
+	return strcmp(entryA->titleCollateKey, entryB->titleCollateKey);
+}
+
+static GPtrArray* getAlphabeticalPlaylists(void) {
+	if (alphabeticalPlaylists == NULL) {
+		alphabeticalPlaylists = g_ptr_array_sized_new(playlists->len);
+		for (unsigned int i = 0; i < playlists->len; i++) {
+			g_ptr_array_add(alphabeticalPlaylists, g_ptr_array_index(playlists, i));
+		}
+		g_ptr_array_sort(alphabeticalPlaylists, compareTitles);
+	}
+
+	return alphabeticalPlaylists;
+}
+
+static GVariant* getPlaylistVariant(struct PlaylistEntry *entry) {
+	return g_variant_new("(oss)", entry->playlistId, entry->title, "");
+}
+
+static GVariant* getActivePlaylistVariant(void) {
+	struct PlaylistEntry *entry = NULL;
+
+	if (activePlaylist != NULL) {
+		entry = g_hash_table_lookup(entriesByPlaylist, activePlaylist);
+	}
+
+	if (entry == NULL) {
+		return g_variant_new("(b(oss))", FALSE, NO_PLAYLIST, "", "");
+	}
+
+	return g_variant_new("(b@(oss))", TRUE, getPlaylistVariant(entry));
+}
+
+static void emitPlaylistsPropertyChanged(const char *propertyName, GVariant *value) {
+	GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE_ARRAY);
+
+	g_variant_builder_add(builder, "{sv}", propertyName, value);
+	GVariant *signal[] = {
+		g_variant_new_string(PLAYLISTS_INTERFACE),
+		g_variant_builder_end(builder),
+		g_variant_new_strv(NULL, 0)
+	};
+
+	emitSignal(PROPERTIES_INTERFACE, "PropertiesChanged", g_variant_new_tuple(signal, 3));
+
+	g_variant_builder_unref(builder);
+}
+
+// Rebuilds the tab order from DeaDBeeF. Entries of playlists which are still there are reused, so ids are stable.
+static void refreshPlaylists(DB_functions_t *deadbeef) {
+	char title[1000];
+	unsigned int oldCount = playlists != NULL ? playlists->len : 0;
+	GPtrArray *oldPlaylists = playlists;
+
+	if (entriesByPlaylist == NULL) {
+		entriesByPlaylist = g_hash_table_new(g_direct_hash, g_direct_equal);
+		entriesById = g_hash_table_new(g_str_hash, g_str_equal);
+	}
+
+	generation++;
+
+	deadbeef->pl_lock();
+	int count = deadbeef->plt_get_count();
+	playlists = g_ptr_array_sized_new(count);
+	for (int i = 0; i < count; i++) {
+		ddb_playlist_t *pl = deadbeef->plt_get_for_idx(i);
+
+		if (pl == NULL) {
+			continue;
+		}
+
+		struct PlaylistEntry *entry = g_hash_table_lookup(entriesByPlaylist, pl);
+		if (entry == NULL) {
+			entry = g_new0(struct PlaylistEntry, 1);
+			entry->playlist = pl;
+			entry->playlistId = g_strdup_printf(PLAYLIST_ID_PREFIX "%" G_GUINT64_FORMAT, nextPlaylistId++);
+			deadbeef->plt_get_title(pl, title, sizeof(title));
+			setTitle(entry, title);
+
+			g_hash_table_insert(entriesByPlaylist, pl, entry);
+			g_hash_table_insert(entriesById, entry->playlistId, entry);
+		} else {
+			deadbeef->plt_unref(pl);
+		}
+		entry->generation = generation;
+		g_ptr_array_add(playlists, entry);
+	}
+	deadbeef->pl_unlock();
+
+	if (oldPlaylists != NULL) {
+		for (unsigned int i = 0; i < oldPlaylists->len; i++) {
+			struct PlaylistEntry *entry = g_ptr_array_index(oldPlaylists, i);
+
+			if (entry->generation != generation) {
+				freeEntry(entry, deadbeef);
+			}
+		}
+		g_ptr_array_unref(oldPlaylists);
+	}
+
+	invalidateAlphabeticalPlaylists();
+
+	// the first build runs inside a client's call, nobody has seen a count before it
+	if (oldPlaylists != NULL && playlists->len != oldCount) {
+		emitPlaylistsPropertyChanged("PlaylistCount", g_variant_new_uint32(playlists->len));
+	}
+}
+
+static void initPlaylists(struct MprisData *mprisData) {
+	if (playlists == NULL) {
+		refreshPlaylists(mprisData->deadbeef);
+		activePlaylist = mprisData->deadbeef->plt_get_curr();
+	}
+}
+
+void playlistsStructureChanged(struct MprisData *mprisData) {
+	if (playlists == NULL) {
+		return;
+	}
+
+	debug("Playlists were added, removed or moved");
+	refreshPlaylists(mprisData->deadbeef);
+}
+
+void playlistsTitleChanged(struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+	char title[1000];
+
+	if (playlists == NULL) {
+		return;
+	}
+
+	for (unsigned int i = 0; i < playlists->len; i++) {
+		struct PlaylistEntry *entry = g_ptr_array_index(playlists, i);
+
+		deadbeef->plt_get_title(entry->playlist, title, sizeof(title));
+		if (strcmp(title, entry->title) != 0) {
+			debug("Playlist %s renamed to %s", entry->playlistId, title);
+			setTitle(entry, title);
+			invalidateAlphabeticalPlaylists();
+			emitSignal(PLAYLISTS_INTERFACE, "PlaylistChanged", g_variant_new("(@(oss))", getPlaylistVariant(entry)));
+		}
+	}
+}
+
+void playlistsActiveChanged(struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+	ddb_playlist_t *pl = deadbeef->plt_get_curr();
+
+	if (playlists == NULL || pl == activePlaylist) {
+		if (pl != NULL) {
+			deadbeef->plt_unref(pl);
+		}
+		return;
+	}
+
+	if (activePlaylist != NULL) {
+		deadbeef->plt_unref(activePlaylist);
+	}
+	activePlaylist = pl;
+
+	if (activePlaylist != NULL && g_hash_table_lookup(entriesByPlaylist, activePlaylist) == NULL) {
+		// switched to a playlist we have not seen yet
+		refreshPlaylists(deadbeef);
+	}
+
+	emitPlaylistsPropertyChanged("ActivePlaylist", getActivePlaylistVariant());
+}
+
+void playlistsFree(struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+
+	if (playlists == NULL) {
+		return;
+	}
+
+	invalidateAlphabeticalPlaylists();
+	for (unsigned int i = 0; i < playlists->len; i++) {
+		freeEntry(g_ptr_array_index(playlists, i), deadbeef);
+	}
+	g_ptr_array_unref(playlists);
+	g_hash_table_unref(entriesByPlaylist);
+	g_hash_table_unref(entriesById);
+	playlists = NULL;
+	entriesByPlaylist = NULL;
+	entriesById = NULL;
+
+	if (activePlaylist != NULL) {
+		deadbeef->plt_unref(activePlaylist);
+		activePlaylist = NULL;
+	}
+}
+
+static void onGetPlaylists(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	guint32 index;
+	guint32 maxCount;
+	const char *order;
+	gboolean reverseOrder;
+	GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("a(oss)"));
+
+	initPlaylists(mprisData);
+
+	g_variant_get(parameters, "(uu&sb)", &index, &maxCount, &order, &reverseOrder);
+	GPtrArray *view = strcmp(order, ORDERING_ALPHABETICAL) == 0 ? getAlphabeticalPlaylists() : playlists;
+
+	for (guint32 i = index; i < view->len && i - index < maxCount; i++) {
+		guint32 position = reverseOrder ? view->len - 1 - i : i;
+		g_variant_builder_add_value(builder, getPlaylistVariant(g_ptr_array_index(view, position)));
+	}
+
+	g_dbus_method_invocation_return_value(invocation, g_variant_new("(a(oss))", builder));
+	g_variant_builder_unref(builder);
+}
+
+static void onActivatePlaylist(GVariant *parameters, GDBusMethodInvocation *invocation,
+                               struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+	const char *playlistId = NULL;
+
+	initPlaylists(mprisData);
+
+	g_variant_get(parameters, "(&o)", &playlistId);
+	struct PlaylistEntry *entry = g_hash_table_lookup(entriesById, playlistId);
+	if (entry != NULL) {
+		deadbeef->plt_set_curr(entry->playlist);
+		deadbeef->sendmessage(DB_EV_PLAY_NUM, 0, 0, 0);
+		g_dbus_method_invocation_return_value(invocation, NULL);
+	} else {
+		g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+		                                      "Unknown playlist %s", playlistId);
+	}
+}
+
+static GVariant* getPlaylistCount(struct MprisData *mprisData) {
+	initPlaylists(mprisData);
+
+	return g_variant_new_uint32(playlists->len);
+}
+
+static GVariant* getOrderings(struct MprisData *mprisData) {
+	const char *orderings[] = { ORDERING_ALPHABETICAL, ORDERING_USER_DEFINED };
+
+	return g_variant_new_strv(orderings, G_N_ELEMENTS(orderings));
+}
+
+static GVariant* getActivePlaylist(struct MprisData *mprisData) {
+	initPlaylists(mprisData);
+
+	return getActivePlaylistVariant();
+}
+
+struct MethodRecord playlistsMethodRecords[] = {
+	{ "GetPlaylists",     onGetPlaylists     },
+	{ "ActivatePlaylist", onActivatePlaylist },
+	{ NULL                                   }
+};
+
+struct PropertyRecord playlistsPropertyRecords[] = {
+	{ "PlaylistCount",  getPlaylistCount,  NULL, FALSE },
+	{ "Orderings",      getOrderings,      NULL, TRUE  },
+	{ "ActivePlaylist", getActivePlaylist, NULL, FALSE },
+	{ NULL                                             }
+};
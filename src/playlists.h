@@ -0,0 +1,14 @@
+#ifndef PLAYLISTS_H_
+#define PLAYLISTS_H_
+
+#include "mprisServer.h"
+
+extern struct MethodRecord playlistsMethodRecords[];
+extern struct PropertyRecord playlistsPropertyRecords[];
+
+void playlistsStructureChanged(struct MprisData*);
+void playlistsTitleChanged(struct MprisData*);
+void playlistsActiveChanged(struct MprisData*);
+void playlistsFree(struct MprisData*);
+
+#endif
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "logging.h"
+#include "position.h"
+#include "sharedState.h"
+
+#define DRIFT_CHECK_INTERVAL 2000 // ms
+#define DRIFT_THRESHOLD 500000 // us
+
+// Last sample of the streamer. Position reads extrapolate from it with the monotonic clock, so polling clients do not
+// hit the streamer. Only accessed from the mpris main context.
+struct PositionSample {
+	DB_playItem_t *track; // referenced in the cache, the position only continues on the same track
+	int state;
+	int64_t position; // us
+	int64_t duration; // us, 0 for streams
+	int64_t timestamp; // monotonic us
+};
+
+static struct PositionSample cache;
+static gboolean cacheValid = FALSE;
+static GSource *driftCheckSource = NULL;
+
+static void takeSample(struct PositionSample *sample, DB_functions_t *deadbeef) {
+	DB_output_t *output = deadbeef->get_output();
+	DB_playItem_t *track = deadbeef->streamer_get_playing_track();
+
+	sample->track = track;
+	sample->state = output != NULL ? output->state() : OUTPUT_STATE_STOPPED;
+	sample->timestamp = g_get_monotonic_time();
+	if (track != NULL) {
+		sample->position = deadbeef->streamer_get_playpos() * 1000000.0;
+		sample->duration = deadbeef->pl_get_item_duration(track) * 1000000.0;
+	} else {
+		sample->position = 0;
+		sample->duration = 0;
+	}
+}
+
+static int64_t extrapolate(const struct PositionSample *sample, int64_t now) {
+	int64_t position = sample->position;
+
+	if (sample->state == OUTPUT_STATE_PLAYING) {
+		position += now - sample->timestamp;
+	}
+	if (sample->duration > 0 && position > sample->duration) {
+		position = sample->duration;
+	}
+
+	return position;
+}
+
+// Takes over the track reference of sample
+static void storeSample(const struct PositionSample *sample, DB_functions_t *deadbeef) {
+	if (cacheValid && cache.track != NULL) {
+		deadbeef->pl_item_unref(cache.track);
+	}
+	cache = *sample;
+	cacheValid = TRUE;
+	sharedStateSetPosition(sample->position, sample->timestamp, sample->duration);
+}
+
+static gboolean onDriftCheck(void *userData) {
+	positionCheckDrift(userData);
+
+	// updateDriftCheck already dropped the source if playback is no longer running
+	return driftCheckSource != NULL ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+// The drift check only runs while playing, paused or stopped positions cannot drift
+static void updateDriftCheck(struct MprisData *mprisData) {
+	if (cache.state == OUTPUT_STATE_PLAYING && driftCheckSource == NULL) {
+		driftCheckSource = g_timeout_source_new(DRIFT_CHECK_INTERVAL);
+		g_source_set_callback(driftCheckSource, onDriftCheck, mprisData, NULL);
+		g_source_attach(driftCheckSource, mprisData->context);
+	} else if (cache.state != OUTPUT_STATE_PLAYING && driftCheckSource != NULL) {
+		g_source_destroy(driftCheckSource);
+		g_source_unref(driftCheckSource);
+		driftCheckSource = NULL;
+	}
+}
+
+int64_t positionGet(struct MprisData *mprisData) {
+	if (!cacheValid) {
+		positionUpdate(mprisData);
+	}
+
+	return extrapolate(&cache, g_get_monotonic_time());
+}
+
+// Resamples the streamer. Called whenever playback state or position changed in a way the extrapolation cannot know.
+void positionUpdate(struct MprisData *mprisData) {
+	struct PositionSample sample;
+
+	takeSample(&sample, mprisData->deadbeef);
+	storeSample(&sample, mprisData->deadbeef);
+	updateDriftCheck(mprisData);
+}
+
+// Compares the extrapolation with the streamer and emits Seeked if they differ by more than DRIFT_THRESHOLD. This
+// catches seeks without DB_EV_SEEKED and buffering stalls. Smaller differences are corrected silently, and so is a
+// different track, whose start is announced with its Metadata.
+void positionCheckDrift(struct MprisData *mprisData) {
+	struct PositionSample sample;
+
+	takeSample(&sample, mprisData->deadbeef);
+
+	if (cacheValid && sample.track == cache.track && sample.state == cache.state) {
+		int64_t drift = sample.position - extrapolate(&cache, sample.timestamp);
+
+		if (llabs(drift) > DRIFT_THRESHOLD) {
+			debug("Position drifted by %" G_GINT64_FORMAT " us", drift);
+			emitSeeked(sample.position / 1000000.0);
+		}
+	}
+
+	storeSample(&sample, mprisData->deadbeef);
+	updateDriftCheck(mprisData);
+}
+
+void positionFree(DB_functions_t *deadbeef) {
+	if (driftCheckSource != NULL) {
+		g_source_destroy(driftCheckSource);
+		g_source_unref(driftCheckSource);
+		driftCheckSource = NULL;
+	}
+	if (cacheValid && cache.track != NULL) {
+		deadbeef->pl_item_unref(cache.track);
+	}
+	cacheValid = FALSE;
+}
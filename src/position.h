@@ -0,0 +1,11 @@
+#ifndef POSITION_H_
+#define POSITION_H_
+
+#include "mprisServer.h"
+
+int64_t positionGet(struct MprisData*);
+void positionUpdate(struct MprisData*);
+void positionCheckDrift(struct MprisData*);
+void positionFree(DB_functions_t*);
+
+#endif
@@ -0,0 +1,150 @@
+#include <glib.h>
+
+#include "logging.h"
+#include "prefetch.h"
+#include "trackId.h"
+
+// Metadata of the track expected to play next, built a few seconds before the playing track ends so the song
+// change is announced with a complete snapshot and the artwork plugin had time to load the cover.
+// Only accessed from the mpris main context.
+static DB_playItem_t *prefetchedTrack = NULL;
+static GVariant *prefetchedMetadata = NULL;
+static GSource *prefetchSource = NULL;
+
+static void dropPrefetchedTrack(DB_functions_t *deadbeef) {
+	if (prefetchedTrack != NULL) {
+		g_variant_unref(prefetchedMetadata);
+		trackIdRelease(prefetchedTrack, deadbeef);
+		deadbeef->pl_item_unref(prefetchedTrack);
+		prefetchedTrack = NULL;
+		prefetchedMetadata = NULL;
+	}
+}
+
+// The streamer may already be buffering the next track. Otherwise it can only be predicted for linear playback.
+static DB_playItem_t* getNextTrack(DB_playItem_t *playingTrack, DB_functions_t *deadbeef) {
+	DB_playItem_t *next = deadbeef->streamer_get_streaming_track();
+
+	if (next != NULL) {
+		if (next != playingTrack) {
+			return next;
+		}
+		deadbeef->pl_item_unref(next);
+	}
+
+	int loop = deadbeef->conf_get_int("playback.loop", PLAYBACK_MODE_LOOP_ALL);
+	int order = deadbeef->conf_get_int("playback.order", PLAYBACK_ORDER_LINEAR);
+	if (loop == PLAYBACK_MODE_LOOP_SINGLE || order != PLAYBACK_ORDER_LINEAR) {
+		return NULL;
+	}
+
+	next = deadbeef->pl_get_next(playingTrack, PL_MAIN);
+	if (next == NULL && loop == PLAYBACK_MODE_LOOP_ALL) {
+		ddb_playlist_t *pl = deadbeef->plt_get_for_idx(deadbeef->streamer_get_current_playlist());
+
+		if (pl != NULL) {
+			next = deadbeef->plt_get_first(pl, PL_MAIN);
+			deadbeef->plt_unref(pl);
+		}
+	}
+
+	return next;
+}
+
+static gboolean onPrefetchTimeout(void *userData) {
+	struct MprisData *mprisData = userData;
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+	DB_playItem_t *playingTrack = deadbeef->streamer_get_playing_track();
+
+	g_source_unref(prefetchSource);
+	prefetchSource = NULL;
+
+	if (playingTrack == NULL) {
+		return G_SOURCE_REMOVE;
+	}
+
+	DB_playItem_t *next = getNextTrack(playingTrack, deadbeef);
+	if (next != NULL && next != playingTrack && next != prefetchedTrack) {
+		dropPrefetchedTrack(deadbeef);
+
+		debug("Prefetching metadata of the next track");
+		prefetchedTrack = next;
+		prefetchedMetadata = g_variant_ref_sink(getMetadataForItem(next, trackIdAcquire(next, deadbeef), mprisData));
+	} else if (next != NULL) {
+		deadbeef->pl_item_unref(next);
+	}
+	deadbeef->pl_item_unref(playingTrack);
+
+	return G_SOURCE_REMOVE;
+}
+
+// (Re)arms the prefetch for the playing track. Has to be called whenever the remaining play time changes.
+void prefetchSchedule(struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+	DB_output_t *output = deadbeef->get_output();
+
+	prefetchCancel();
+
+	if (mprisData->prefetchTime <= 0 || output == NULL || output->state() != OUTPUT_STATE_PLAYING) {
+		return;
+	}
+
+	DB_playItem_t *track = deadbeef->streamer_get_playing_track();
+	if (track == NULL) {
+		return;
+	}
+
+	float duration = deadbeef->pl_get_item_duration(track);
+	float remaining = duration - deadbeef->streamer_get_playpos();
+	deadbeef->pl_item_unref(track);
+
+	if (duration <= 0) { // streams have no end to prefetch for
+		return;
+	}
+
+	unsigned int delay = remaining > mprisData->prefetchTime ? (remaining - mprisData->prefetchTime) * 1000 : 0;
+	debug("Prefetching next track in %u ms", delay);
+
+	prefetchSource = g_timeout_source_new(delay);
+	g_source_set_callback(prefetchSource, onPrefetchTimeout, mprisData, NULL);
+	g_source_attach(prefetchSource, mprisData->context);
+}
+
+void prefetchCancel(void) {
+	if (prefetchSource != NULL) {
+		g_source_destroy(prefetchSource);
+		g_source_unref(prefetchSource);
+		prefetchSource = NULL;
+	}
+}
+
+// Returns the prefetched metadata if it was built for track, NULL otherwise. The track id acquired for it is handed
+// over to the caller.
+GVariant* prefetchTake(DB_playItem_t *track, DB_functions_t *deadbeef) {
+	if (track == NULL || track != prefetchedTrack) {
+		return NULL;
+	}
+
+	GVariant *metadata = prefetchedMetadata;
+
+	deadbeef->pl_item_unref(prefetchedTrack);
+	prefetchedTrack = NULL;
+	prefetchedMetadata = NULL;
+
+	return metadata;
+}
+
+void prefetchTrackInfoChanged(DB_playItem_t *track, DB_functions_t *deadbeef) {
+	if (track == prefetchedTrack) {
+		dropPrefetchedTrack(deadbeef);
+	}
+}
+
+void prefetchInvalidate(DB_functions_t *deadbeef) {
+	dropPrefetchedTrack(deadbeef);
+}
+
+void prefetchFree(DB_functions_t *deadbeef) {
+	prefetchCancel();
+	dropPrefetchedTrack(deadbeef);
+}
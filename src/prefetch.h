@@ -0,0 +1,13 @@
+#ifndef PREFETCH_H_
+#define PREFETCH_H_
+
+#include "mprisServer.h"
+
+void prefetchSchedule(struct MprisData*);
+void prefetchCancel(void);
+GVariant* prefetchTake(DB_playItem_t*, DB_functions_t*);
+void prefetchTrackInfoChanged(DB_playItem_t*, DB_functions_t*);
+void prefetchInvalidate(DB_functions_t*);
+void prefetchFree(DB_functions_t*);
+
+#endif
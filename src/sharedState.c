@@ -0,0 +1,183 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "logging.h"
+#include "sharedState.h"
+
+// The mapped block, NULL unless mpris2.shared_state is enabled. Only written from the mpris main context, so there
+// is a single writer and the seqlock needs no further locking.
+static struct SharedState *block = NULL;
+static char blockName[64];
+static int blockFd = -1;
+
+static void beginWrite(void) {
+	__atomic_store_n(&block->sequence, block->sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void endWrite(void) {
+	__atomic_store_n(&block->sequence, block->sequence + 1, __ATOMIC_RELEASE);
+}
+
+void sharedStateOpen(void) {
+	struct stat info;
+
+	g_snprintf(blockName, sizeof(blockName), SHARED_STATE_NAME, (unsigned int)getuid());
+
+	// a block left behind by a crashed instance is reused, after the checks below
+	int fd = shm_open(blockName, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0 && errno == EEXIST) {
+		fd = shm_open(blockName, O_RDWR, 0);
+	}
+	if (fd < 0) {
+		error("cannot create shared state %s", blockName);
+		return;
+	}
+
+	// the name is predictable, so someone else may have created it first
+	if (fstat(fd, &info) != 0 || info.st_uid != getuid() || (info.st_mode & 077) != 0) {
+		error("shared state %s is not private to this user, not publishing", blockName);
+		close(fd);
+		return;
+	}
+
+	// held until sharedStateClose, the seqlock allows only one writer
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		error("shared state %s is published by another instance", blockName);
+		close(fd);
+		return;
+	}
+
+	if (ftruncate(fd, sizeof(struct SharedState)) == 0) {
+		void *mapping = mmap(NULL, sizeof(struct SharedState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+		if (mapping != MAP_FAILED) {
+			block = mapping;
+		}
+	}
+
+	if (block == NULL) {
+		error("cannot map shared state %s", blockName);
+		shm_unlink(blockName);
+		close(fd);
+		return;
+	}
+	blockFd = fd;
+
+	// readers of a block left behind by a crashed instance see it being rewritten
+	beginWrite();
+	memset((char *)block + offsetof(struct SharedState, playbackStatus), 0,
+	       sizeof(struct SharedState) - offsetof(struct SharedState, playbackStatus));
+	block->magic = SHARED_STATE_MAGIC;
+	block->version = SHARED_STATE_VERSION;
+	endWrite();
+	debug("Publishing state in %s", blockName);
+}
+
+void sharedStateSetPlaybackStatus(int status) {
+	if (block != NULL) {
+		beginWrite();
+		block->playbackStatus = status;
+		endWrite();
+	}
+}
+
+void sharedStateSetLoopMode(int mode) {
+	if (block != NULL) {
+		beginWrite();
+		block->loopMode = mode;
+		endWrite();
+	}
+}
+
+void sharedStateSetPlaybackOrder(int order) {
+	if (block != NULL) {
+		beginWrite();
+		block->playbackOrder = order;
+		endWrite();
+	}
+}
+
+void sharedStateSetVolume(float volume) {
+	if (block != NULL) {
+		beginWrite();
+		block->volume = volume;
+		endWrite();
+	}
+}
+
+// position and duration in us, timestamp in monotonic us
+void sharedStateSetPosition(int64_t position, int64_t timestamp, int64_t duration) {
+	if (block != NULL) {
+		beginWrite();
+		block->position = position;
+		block->positionTimestamp = timestamp;
+		block->duration = duration;
+		endWrite();
+	}
+}
+
+// g_strlcpy/g_strlcat may have cut the last character in half
+static void trimUtf8(char *buf) {
+	const char *end = NULL;
+
+	if (!g_utf8_validate(buf, -1, &end)) {
+		buf[end - buf] = '\0';
+	}
+}
+
+static void copyString(char *buf, GVariant *metadata, const char *key, const char *type) {
+	const char *value = NULL;
+
+	if (!g_variant_lookup(metadata, key, type, &value)) {
+		value = "";
+	}
+	g_strlcpy(buf, value, SHARED_STATE_STRING_SIZE);
+	trimUtf8(buf);
+}
+
+static void copyArtists(char *buf, GVariant *metadata) {
+	const char **artists = NULL;
+
+	buf[0] = '\0';
+	if (g_variant_lookup(metadata, "xesam:artist", "^a&s", &artists)) {
+		for (int i = 0; artists[i] != NULL; i++) {
+			if (i > 0) {
+				g_strlcat(buf, ", ", SHARED_STATE_STRING_SIZE);
+			}
+			g_strlcat(buf, artists[i], SHARED_STATE_STRING_SIZE);
+		}
+		g_free(artists);
+	}
+	trimUtf8(buf);
+}
+
+void sharedStateSetMetadata(GVariant *metadata) {
+	if (block != NULL) {
+		beginWrite();
+		copyString(block->trackId, metadata, "mpris:trackid", "&o");
+		copyString(block->title, metadata, "xesam:title", "&s");
+		copyArtists(block->artist, metadata);
+		copyString(block->album, metadata, "xesam:album", "&s");
+		copyString(block->artUrl, metadata, "mpris:artUrl", "&s");
+		endWrite();
+	}
+}
+
+void sharedStateClose(void) {
+	if (block != NULL) {
+		munmap(block, sizeof(struct SharedState));
+		shm_unlink(blockName);
+		close(blockFd);
+		block = NULL;
+		blockFd = -1;
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef SHAREDSTATE_H_
+#define SHAREDSTATE_H_
+
+#include <stdint.h>
+
+#include "mprisServer.h"
+
+// Layout of the block published in /dev/shm/deadbeef-mpris2-<uid> when mpris2.shared_state is enabled. Only the
+// first running instance publishes, it holds a flock on the object. Readers copy it while sequence is even and unchanged before and after the copy (a seqlock):
+//
+//	do {
+//		begin = __atomic_load_n(&block->sequence, __ATOMIC_ACQUIRE);
+//		memcpy(&copy, block, sizeof(copy));
+//		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+//	} while ((begin & 1) || begin != __atomic_load_n(&block->sequence, __ATOMIC_RELAXED));
+//
+// While playing, the current position is position + (CLOCK_MONOTONIC now in us - positionTimestamp), capped at
+// duration. Strings are UTF-8, always terminated and cut at SHARED_STATE_STRING_SIZE.
+#define SHARED_STATE_NAME "/deadbeef-mpris2-%u"
+#define SHARED_STATE_MAGIC 0x3253504d // "MPS2"
+#define SHARED_STATE_VERSION 1
+#define SHARED_STATE_STRING_SIZE 512
+
+struct SharedState {
+	uint32_t magic;
+	uint32_t version; // bumped on incompatible layout changes
+	uint32_t sequence; // odd while the block is written
+	int32_t playbackStatus; // OUTPUT_STATE_*
+	int32_t loopMode; // PLAYBACK_MODE_*
+	int32_t playbackOrder; // PLAYBACK_ORDER_*
+	float volume; // dB
+	int64_t position; // us at positionTimestamp
+	int64_t positionTimestamp; // CLOCK_MONOTONIC us
+	int64_t duration; // us, 0 for streams
+	char trackId[SHARED_STATE_STRING_SIZE];
+	char title[SHARED_STATE_STRING_SIZE];
+	char artist[SHARED_STATE_STRING_SIZE]; // all artists joined with ", "
+	char album[SHARED_STATE_STRING_SIZE];
+	char artUrl[SHARED_STATE_STRING_SIZE];
+};
+
+void sharedStateOpen(void);
+void sharedStateSetPlaybackStatus(int);
+void sharedStateSetLoopMode(int);
+void sharedStateSetPlaybackOrder(int);
+void sharedStateSetVolume(float);
+void sharedStateSetPosition(int64_t, int64_t, int64_t);
+void sharedStateSetMetadata(GVariant*);
+void sharedStateClose(void);
+
+#endif
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "logging.h"
+#include "stats.h"
+
+#define STATS_BUCKETS 32 // bucket n counts calls which took [2^n, 2^(n+1)) ns, the last one everything slower
+
+// Call counts and latency histograms of every method call, property access and signal emission. Counters are
+// created on the mpris main context, the values are updated with atomics so they can be read from anywhere.
+struct StatsCounter {
+	int kind;
+	char *name;
+	uint64_t calls;
+	uint64_t totalNs;
+	uint64_t maxNs;
+	uint64_t histogram[STATS_BUCKETS];
+};
+
+static const char *kindNames[] = { "method", "get", "set", "signal" };
+
+static gboolean enabled = FALSE;
+static GHashTable *counters = NULL; // "<kind> <interface>.<member>" -> counter
+
+static void freeCounter(void *data) {
+	struct StatsCounter *counter = data;
+
+	g_free(counter->name);
+	g_free(counter);
+}
+
+void statsInit(gboolean enable) {
+	enabled = enable;
+	if (enabled && counters == NULL) {
+		counters = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, freeCounter);
+	}
+}
+
+// Returns NULL while statistics are disabled, statsEnd ignores NULL counters. Looking a counter up formats its key,
+// so callers on hot paths resolve it once, see buildDispatchTables.
+struct StatsCounter* statsCounter(int kind, const char *interfaceName, const char *member) {
+	char key[256];
+
+	if (!enabled) {
+		return NULL;
+	}
+
+	g_snprintf(key, sizeof(key), "%d %s.%s", kind, interfaceName, member);
+	struct StatsCounter *counter = g_hash_table_lookup(counters, key);
+	if (counter == NULL) {
+		counter = g_new0(struct StatsCounter, 1);
+		counter->kind = kind;
+		counter->name = g_strdup_printf("%s.%s", interfaceName, member);
+		g_hash_table_insert(counters, g_strdup(key), counter);
+	}
+
+	return counter;
+}
+
+int64_t statsBegin(void) {
+	struct timespec now;
+
+	if (!enabled) {
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void statsEnd(struct StatsCounter *counter, int64_t begin) {
+	if (counter == NULL) {
+		return;
+	}
+
+	uint64_t ns = statsBegin() - begin;
+	int bucket = 63 - __builtin_clzll(ns | 1);
+	if (bucket >= STATS_BUCKETS) {
+		bucket = STATS_BUCKETS - 1;
+	}
+
+	__atomic_fetch_add(&counter->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counter->totalNs, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counter->histogram[bucket], 1, __ATOMIC_RELAXED);
+
+	uint64_t maxNs = __atomic_load_n(&counter->maxNs, __ATOMIC_RELAXED);
+	while (ns > maxNs && !__atomic_compare_exchange_n(&counter->maxNs, &maxNs, ns, TRUE, __ATOMIC_RELAXED,
+	                                                  __ATOMIC_RELAXED)) {
+	}
+}
+
+static int compareCounters(const void *a, const void *b) {
+	const struct StatsCounter *counterA = *(struct StatsCounter * const *)a;
+	const struct StatsCounter *counterB = *(struct StatsCounter * const *)b;
+
+	if (counterA->kind != counterB->kind) {
+		return counterA->kind - counterB->kind;
+	}
+	return strcmp(counterA->name, counterB->name);
+}
+
+// Counters sorted by kind and name. The array has to be freed, the counters not.
+static GPtrArray* getSortedCounters(void) {
+	GPtrArray *sorted = g_ptr_array_new();
+	GHashTableIter iter;
+	void *counter;
+
+	if (counters != NULL) {
+		g_hash_table_iter_init(&iter, counters);
+		while (g_hash_table_iter_next(&iter, NULL, &counter)) {
+			g_ptr_array_add(sorted, counter);
+		}
+	}
+	g_ptr_array_sort(sorted, compareCounters);
+
+	return sorted;
+}
+
+// Returns a(sstttat): kind, interface.member, calls, total ns, max ns and the log2 ns histogram of every counter
+GVariant* statsDump(void) {
+	GPtrArray *sorted = getSortedCounters();
+	GVariantBuilder builder;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(sstttat)"));
+	for (unsigned int i = 0; i < sorted->len; i++) {
+		struct StatsCounter *counter = g_ptr_array_index(sorted, i);
+		guint64 histogram[STATS_BUCKETS];
+
+		for (int bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+			histogram[bucket] = __atomic_load_n(&counter->histogram[bucket], __ATOMIC_RELAXED);
+		}
+
+		g_variant_builder_add(&builder, "(ssttt@at)", kindNames[counter->kind], counter->name,
+		                      (guint64)__atomic_load_n(&counter->calls, __ATOMIC_RELAXED),
+		                      (guint64)__atomic_load_n(&counter->totalNs, __ATOMIC_RELAXED),
+		                      (guint64)__atomic_load_n(&counter->maxNs, __ATOMIC_RELAXED),
+		                      g_variant_new_fixed_array(G_VARIANT_TYPE_UINT64, histogram, STATS_BUCKETS,
+		                                                sizeof(guint64)));
+	}
+	g_ptr_array_unref(sorted);
+
+	return g_variant_builder_end(&builder);
+}
+
+static void dumpToFile(const char *path) {
+	FILE *file = fopen(path, "w");
+
+	if (file == NULL) {
+		error("cannot write statistics to %s", path);
+		return;
+	}
+
+	GPtrArray *sorted = getSortedCounters();
+	for (unsigned int i = 0; i < sorted->len; i++) {
+		struct StatsCounter *counter = g_ptr_array_index(sorted, i);
+
+		fprintf(file, "%s %s calls=%" G_GUINT64_FORMAT " total_ns=%" G_GUINT64_FORMAT " max_ns=%" G_GUINT64_FORMAT
+		        " log2_ns_histogram=", kindNames[counter->kind], counter->name, (guint64)counter->calls,
+		        (guint64)counter->totalNs, (guint64)counter->maxNs);
+		for (int bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+			fprintf(file, bucket > 0 ? ",%" G_GUINT64_FORMAT : "%" G_GUINT64_FORMAT, (guint64)counter->histogram[bucket]);
+		}
+		fputc('\n', file);
+	}
+	g_ptr_array_unref(sorted);
+
+	fclose(file);
+}
+
+// Writes the statistics to dumpPath first, unless it is NULL or empty
+void statsFree(const char *dumpPath) {
+	if (enabled && dumpPath != NULL && dumpPath[0] != '\0') {
+		dumpToFile(dumpPath);
+	}
+
+	if (counters != NULL) {
+		g_hash_table_unref(counters);
+		counters = NULL;
+	}
+	enabled = FALSE;
+}
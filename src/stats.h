@@ -0,0 +1,20 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include "mprisServer.h"
+
+#define STATS_METHOD 0
+#define STATS_GET 1
+#define STATS_SET 2
+#define STATS_SIGNAL 3
+
+struct StatsCounter;
+
+void statsInit(gboolean);
+struct StatsCounter* statsCounter(int, const char*, const char*);
+int64_t statsBegin(void);
+void statsEnd(struct StatsCounter*, int64_t);
+GVariant* statsDump(void);
+void statsFree(const char*);
+
+#endif
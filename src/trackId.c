@@ -0,0 +1,101 @@
+#include <stdint.h>
+#include <inttypes.h>
+
+#include <glib.h>
+
+#include "logging.h"
+#include "trackId.h"
+
+#define TRACK_ID_PREFIX "/DeaDBeeF/Track/"
+
+struct TrackId {
+	DB_playItem_t *track;
+	char *path;
+	int useCount;
+};
+
+// Object path ids for play items. An id stays the same for as long as somebody (the track list or the Metadata
+// cache) uses it, no matter where the item moves in its playlist. Ids are never reused.
+// Only accessed from the mpris main context.
+static GHashTable *idsByTrack = NULL;
+static GHashTable *idsByPath = NULL;
+static guint64 nextId = 0;
+
+const char* trackIdAcquire(DB_playItem_t *track, DB_functions_t *deadbeef) {
+	if (idsByTrack == NULL) {
+		idsByTrack = g_hash_table_new(g_direct_hash, g_direct_equal);
+		idsByPath = g_hash_table_new(g_str_hash, g_str_equal);
+	}
+
+	struct TrackId *id = g_hash_table_lookup(idsByTrack, track);
+	if (id == NULL) {
+		id = g_new0(struct TrackId, 1);
+		deadbeef->pl_item_ref(track);
+		id->track = track;
+		id->path = g_strdup_printf(TRACK_ID_PREFIX "%" G_GUINT64_FORMAT, nextId++);
+
+		g_hash_table_insert(idsByTrack, track, id);
+		g_hash_table_insert(idsByPath, id->path, id);
+	}
+	id->useCount++;
+
+	return id->path;
+}
+
+void trackIdRelease(DB_playItem_t *track, DB_functions_t *deadbeef) {
+	if (idsByTrack == NULL) {
+		return;
+	}
+
+	struct TrackId *id = g_hash_table_lookup(idsByTrack, track);
+	if (id == NULL || --id->useCount > 0) {
+		return;
+	}
+
+	g_hash_table_remove(idsByTrack, track);
+	g_hash_table_remove(idsByPath, id->path);
+	deadbeef->pl_item_unref(id->track);
+	g_free(id->path);
+	g_free(id);
+}
+
+const char* trackIdLookup(DB_playItem_t *track) {
+	if (idsByTrack == NULL) {
+		return NULL;
+	}
+
+	struct TrackId *id = g_hash_table_lookup(idsByTrack, track);
+
+	return id != NULL ? id->path : NULL;
+}
+
+DB_playItem_t* trackIdGetTrack(const char *path) {
+	if (idsByPath == NULL) {
+		return NULL;
+	}
+
+	struct TrackId *id = g_hash_table_lookup(idsByPath, path);
+
+	return id != NULL ? id->track : NULL;
+}
+
+void trackIdFreeAll(DB_functions_t *deadbeef) {
+	if (idsByTrack == NULL) {
+		return;
+	}
+
+	GHashTableIter iter;
+	struct TrackId *id;
+
+	g_hash_table_iter_init(&iter, idsByTrack);
+	while (g_hash_table_iter_next(&iter, NULL, (void **)&id)) {
+		deadbeef->pl_item_unref(id->track);
+		g_free(id->path);
+		g_free(id);
+	}
+
+	g_hash_table_unref(idsByTrack);
+	g_hash_table_unref(idsByPath);
+	idsByTrack = NULL;
+	idsByPath = NULL;
+}
@@ -0,0 +1,12 @@
+#ifndef TRACKID_H_
+#define TRACKID_H_
+
+#include "mprisServer.h"
+
+const char* trackIdAcquire(DB_playItem_t*, DB_functions_t*);
+void trackIdRelease(DB_playItem_t*, DB_functions_t*);
+const char* trackIdLookup(DB_playItem_t*);
+DB_playItem_t* trackIdGetTrack(const char*);
+void trackIdFreeAll(DB_functions_t*);
+
+#endif
@@ -0,0 +1,428 @@
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "logging.h"
+#include "trackId.h"
+#include "trackList.h"
+
+// With more changes than this a single TrackListReplaced is cheaper for clients than one signal per track
+#define MAX_INCREMENTAL_CHANGES 64
+
+struct TrackListEntry {
+	DB_playItem_t *track;
+	const char *trackId;
+	GVariant *metadata; // built on first request
+	int index;
+	unsigned int generation;
+};
+
+// The track list mirrors the playlist of the playing track (or the current playlist if nothing is playing). Entries
+// are kept across playlist changes so only tracks which were actually added get new ids and metadata.
+// Only accessed from the mpris main context.
+static ddb_playlist_t *trackListPlaylist = NULL;
+static GPtrArray *entries = NULL;
+static GHashTable *entriesByTrack = NULL;
+static unsigned int generation = 0;
+static int modificationIndex = 0; // of trackListPlaylist at the last walk
+
+// Results of the last walk, kept between walks so a walk allocates nothing but entries of new tracks
+static GPtrArray *addedEntries = NULL;
+static GPtrArray *removedEntries = NULL;
+static GPtrArray *displacedEntries = NULL; // overwritten in entries, removed unless the walk met them again
+
+static void initTables(void) {
+	if (entries == NULL) {
+		entries = g_ptr_array_new();
+		entriesByTrack = g_hash_table_new(g_direct_hash, g_direct_equal);
+		addedEntries = g_ptr_array_new();
+		removedEntries = g_ptr_array_new();
+		displacedEntries = g_ptr_array_new();
+	}
+}
+
+static struct TrackListEntry* createEntry(DB_playItem_t *track, DB_functions_t *deadbeef) {
+	struct TrackListEntry *entry = g_new0(struct TrackListEntry, 1);
+
+	// the id holds a reference to the track
+	entry->trackId = trackIdAcquire(track, deadbeef);
+	entry->track = track;
+
+	g_hash_table_insert(entriesByTrack, track, entry);
+
+	return entry;
+}
+
+static struct TrackListEntry* lookupEntry(const char *trackId) {
+	DB_playItem_t *track = trackIdGetTrack(trackId);
+
+	return track != NULL ? g_hash_table_lookup(entriesByTrack, track) : NULL;
+}
+
+static void freeEntry(struct TrackListEntry *entry, DB_functions_t *deadbeef) {
+	g_hash_table_remove(entriesByTrack, entry->track);
+
+	if (entry->metadata != NULL) {
+		g_variant_unref(entry->metadata);
+	}
+	trackIdRelease(entry->track, deadbeef);
+	g_free(entry);
+}
+
+static void clearEntries(DB_functions_t *deadbeef) {
+	for (unsigned int i = 0; i < entries->len; i++) {
+		freeEntry(g_ptr_array_index(entries, i), deadbeef);
+	}
+	g_ptr_array_set_size(entries, 0);
+}
+
+static GVariant* getEntryMetadata(struct TrackListEntry *entry, struct MprisData *mprisData) {
+	if (entry->metadata == NULL) {
+		entry->metadata = g_variant_ref_sink(getMetadataForItem(entry->track, entry->trackId, mprisData));
+	}
+
+	return entry->metadata;
+}
+
+// Walks the playlist once and rewrites entries in place, in playlist order. Entries of known tracks are reused and
+// new ones go to addedEntries, entries of tracks which are gone to removedEntries. Returns whether the tracks which
+// are still there changed their relative order.
+static gboolean walkPlaylist(DB_functions_t *deadbeef) {
+	unsigned int count = 0;
+	int lastIndex = -1;
+	gboolean reordered = FALSE;
+
+	generation++;
+	g_ptr_array_set_size(addedEntries, 0);
+	g_ptr_array_set_size(removedEntries, 0);
+	g_ptr_array_set_size(displacedEntries, 0);
+
+	deadbeef->pl_lock();
+	modificationIndex = deadbeef->plt_get_modification_idx(trackListPlaylist);
+	DB_playItem_t *track = deadbeef->plt_get_first(trackListPlaylist, PL_MAIN);
+	while (track != NULL) {
+		struct TrackListEntry *entry = g_hash_table_lookup(entriesByTrack, track);
+
+		if (entry == NULL) {
+			entry = createEntry(track, deadbeef);
+			g_ptr_array_add(addedEntries, entry);
+		} else {
+			// index is still the one of the previous walk
+			if (entry->index < lastIndex) {
+				reordered = TRUE;
+			}
+			lastIndex = entry->index;
+		}
+
+		if (count < entries->len) {
+			struct TrackListEntry *occupant = g_ptr_array_index(entries, count);
+
+			if (occupant != entry && occupant->generation != generation) {
+				g_ptr_array_add(displacedEntries, occupant);
+			}
+			entries->pdata[count] = entry;
+		} else {
+			g_ptr_array_add(entries, entry);
+		}
+		entry->index = count++;
+		entry->generation = generation;
+
+		DB_playItem_t *next = deadbeef->pl_get_next(track, PL_MAIN);
+		deadbeef->pl_item_unref(track);
+		track = next;
+	}
+	deadbeef->pl_unlock();
+
+	for (unsigned int i = count; i < entries->len; i++) {
+		struct TrackListEntry *occupant = g_ptr_array_index(entries, i);
+
+		if (occupant->generation != generation) {
+			g_ptr_array_add(displacedEntries, occupant);
+		}
+	}
+	g_ptr_array_set_size(entries, count);
+
+	for (unsigned int i = 0; i < displacedEntries->len; i++) {
+		struct TrackListEntry *entry = g_ptr_array_index(displacedEntries, i);
+
+		if (entry->generation != generation) {
+			g_ptr_array_add(removedEntries, entry);
+		}
+	}
+	g_ptr_array_set_size(displacedEntries, 0);
+
+	return reordered;
+}
+
+static GVariant* getTrackIds(void) {
+	GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("ao"));
+
+	for (unsigned int i = 0; i < entries->len; i++) {
+		struct TrackListEntry *entry = g_ptr_array_index(entries, i);
+		g_variant_builder_add(builder, "o", entry->trackId);
+	}
+
+	GVariant *result = g_variant_builder_end(builder);
+	g_variant_builder_unref(builder);
+
+	return result;
+}
+
+static void emitTrackListReplaced(DB_functions_t *deadbeef) {
+	const char *currentTrackId = NULL;
+	DB_playItem_t *track = deadbeef->streamer_get_playing_track();
+
+	if (track != NULL) {
+		currentTrackId = trackIdLookup(track);
+		deadbeef->pl_item_unref(track);
+	}
+
+	debug("Track list replaced, %u tracks", entries->len);
+	emitSignal(TRACKLIST_INTERFACE, "TrackListReplaced",
+	           g_variant_new("(@aoo)", getTrackIds(), currentTrackId != NULL ? currentTrackId : NO_TRACK));
+}
+
+static void emitTracksInvalidated(void) {
+	const char *invalidatedProperties[] = { "Tracks", NULL };
+
+	emitSignal(PROPERTIES_INTERFACE, "PropertiesChanged",
+	           g_variant_new("(s@a{sv}^as)", TRACKLIST_INTERFACE, g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0),
+	                         invalidatedProperties));
+}
+
+gboolean trackListUpdatePlaylist(struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+	ddb_playlist_t *pl = NULL;
+	int playlistIndex = deadbeef->streamer_get_current_playlist();
+
+	initTables();
+
+	if (playlistIndex >= 0) {
+		pl = deadbeef->plt_get_for_idx(playlistIndex);
+	}
+	if (pl == NULL) {
+		pl = deadbeef->plt_get_curr();
+	}
+
+	if (pl == trackListPlaylist) {
+		if (pl != NULL) {
+			deadbeef->plt_unref(pl);
+		}
+		return FALSE;
+	}
+
+	debug("Track list follows a new playlist");
+	clearEntries(deadbeef);
+	if (trackListPlaylist != NULL) {
+		deadbeef->plt_unref(trackListPlaylist);
+	}
+	trackListPlaylist = pl;
+
+	if (trackListPlaylist != NULL) {
+		walkPlaylist(deadbeef);
+	}
+
+	emitTrackListReplaced(deadbeef);
+	emitTracksInvalidated();
+
+	return TRUE;
+}
+
+void trackListContentChanged(struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+
+	if (trackListPlaylist == NULL) {
+		return;
+	}
+
+	// the event does not tell which playlist changed, only a change of the mirrored one needs a walk
+	if (deadbeef->plt_get_modification_idx(trackListPlaylist) == modificationIndex) {
+		return;
+	}
+
+	// DeaDBeeF does not tell which tracks changed either, so the playlist is walked and diffed against entries
+	gboolean reordered = walkPlaylist(deadbeef);
+
+	if (addedEntries->len == 0 && removedEntries->len == 0 && !reordered) {
+		debug("Track list did not change");
+	} else {
+		if (reordered || addedEntries->len + removedEntries->len > MAX_INCREMENTAL_CHANGES) {
+			emitTrackListReplaced(deadbeef);
+		} else {
+			debug("Track list changed, %u added, %u removed", addedEntries->len, removedEntries->len);
+			for (unsigned int i = 0; i < removedEntries->len; i++) {
+				struct TrackListEntry *entry = g_ptr_array_index(removedEntries, i);
+				emitSignal(TRACKLIST_INTERFACE, "TrackRemoved", g_variant_new("(o)", entry->trackId));
+			}
+			for (unsigned int i = 0; i < addedEntries->len; i++) {
+				struct TrackListEntry *entry = g_ptr_array_index(addedEntries, i);
+				const char *afterTrackId = NO_TRACK;
+
+				if (entry->index > 0) {
+					afterTrackId = ((struct TrackListEntry *)g_ptr_array_index(entries, entry->index - 1))->trackId;
+				}
+				emitSignal(TRACKLIST_INTERFACE, "TrackAdded",
+				           g_variant_new("(@a{sv}o)", getEntryMetadata(entry, mprisData), afterTrackId));
+			}
+		}
+		emitTracksInvalidated();
+	}
+
+	for (unsigned int i = 0; i < removedEntries->len; i++) {
+		freeEntry(g_ptr_array_index(removedEntries, i), deadbeef);
+	}
+	g_ptr_array_set_size(removedEntries, 0);
+	g_ptr_array_set_size(addedEntries, 0);
+}
+
+void trackListTrackInfoChanged(DB_playItem_t *track, struct MprisData *mprisData) {
+	if (entriesByTrack == NULL) {
+		return;
+	}
+
+	struct TrackListEntry *entry = g_hash_table_lookup(entriesByTrack, track);
+	if (entry == NULL) {
+		return;
+	}
+
+	if (entry->metadata != NULL) {
+		g_variant_unref(entry->metadata);
+		entry->metadata = NULL;
+	}
+
+	emitSignal(TRACKLIST_INTERFACE, "TrackMetadataChanged",
+	           g_variant_new("(o@a{sv})", entry->trackId, getEntryMetadata(entry, mprisData)));
+}
+
+// Every entry's metadata is stale, clients are told to fetch the list again
+void trackListMetadataFormatChanged(struct MprisData *mprisData) {
+	if (entries == NULL) {
+		return;
+	}
+
+	for (unsigned int i = 0; i < entries->len; i++) {
+		struct TrackListEntry *entry = g_ptr_array_index(entries, i);
+
+		if (entry->metadata != NULL) {
+			g_variant_unref(entry->metadata);
+			entry->metadata = NULL;
+		}
+	}
+
+	emitTrackListReplaced(mprisData->deadbeef);
+}
+
+// Index of a track in the mirrored playlist without walking it, -1 if the track list does not mirror pl
+int trackListGetIndex(ddb_playlist_t *pl, DB_playItem_t *track) {
+	if (pl == NULL || pl != trackListPlaylist || track == NULL) {
+		return -1;
+	}
+
+	struct TrackListEntry *entry = g_hash_table_lookup(entriesByTrack, track);
+	return entry != NULL ? entry->index : -1;
+}
+
+void trackListFree(struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+
+	if (entries == NULL) {
+		return;
+	}
+
+	clearEntries(deadbeef);
+	g_ptr_array_unref(entries);
+	g_hash_table_unref(entriesByTrack);
+	g_ptr_array_unref(addedEntries);
+	g_ptr_array_unref(removedEntries);
+	g_ptr_array_unref(displacedEntries);
+	entries = NULL;
+	entriesByTrack = NULL;
+	addedEntries = NULL;
+	removedEntries = NULL;
+	displacedEntries = NULL;
+
+	if (trackListPlaylist != NULL) {
+		deadbeef->plt_unref(trackListPlaylist);
+		trackListPlaylist = NULL;
+	}
+}
+
+static void onGetTracksMetadata(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	const char **trackIds = NULL;
+	GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("aa{sv}"));
+
+	initTables();
+
+	g_variant_get(parameters, "(^a&o)", &trackIds);
+	for (const char **trackId = trackIds; *trackId; trackId++) {
+		struct TrackListEntry *entry = lookupEntry(*trackId);
+
+		if (entry != NULL) {
+			g_variant_builder_add(builder, "@a{sv}", getEntryMetadata(entry, mprisData));
+		} else {
+			debug("Unknown track id %s", *trackId);
+		}
+	}
+	g_free(trackIds);
+
+	g_dbus_method_invocation_return_value(invocation, g_variant_new("(aa{sv})", builder));
+	g_variant_builder_unref(builder);
+}
+
+static void onGoTo(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+	const char *trackId = NULL;
+
+	initTables();
+
+	g_variant_get(parameters, "(&o)", &trackId);
+	struct TrackListEntry *entry = lookupEntry(trackId);
+	if (entry != NULL) {
+		ddb_playlist_t *pl = deadbeef->plt_get_curr();
+		// entry->index may predate a change whose event is still queued
+		int index = deadbeef->plt_get_item_idx(trackListPlaylist, entry->track, PL_MAIN);
+
+		if (index >= 0) {
+			if (pl != trackListPlaylist) {
+				deadbeef->plt_set_curr(trackListPlaylist);
+			}
+			deadbeef->sendmessage(DB_EV_PLAY_NUM, 0, index, 0);
+		}
+		if (pl != NULL) {
+			deadbeef->plt_unref(pl);
+		}
+	}
+	g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+// CanEditTracks is false, so AddTrack and RemoveTrack have no effect
+static void onEditTracks(GVariant *parameters, GDBusMethodInvocation *invocation, struct MprisData *mprisData) {
+	g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+static GVariant* getTracks(struct MprisData *mprisData) {
+	initTables();
+
+	return getTrackIds();
+}
+
+static GVariant* getCanEditTracks(struct MprisData *mprisData) {
+	return g_variant_new_boolean(FALSE);
+}
+
+struct MethodRecord trackListMethodRecords[] = {
+	{ "GetTracksMetadata", onGetTracksMetadata },
+	{ "GoTo",              onGoTo              },
+	{ "AddTrack",          onEditTracks        },
+	{ "RemoveTrack",       onEditTracks        },
+	{ NULL                                     }
+};
+
+struct PropertyRecord trackListPropertyRecords[] = {
+	{ "Tracks",        getTracks,        NULL, FALSE },
+	{ "CanEditTracks", getCanEditTracks, NULL, TRUE  },
+	{ NULL                                           }
+};
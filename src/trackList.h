@@ -0,0 +1,16 @@
+#ifndef TRACKLIST_H_
+#define TRACKLIST_H_
+
+#include "mprisServer.h"
+
+extern struct MethodRecord trackListMethodRecords[];
+extern struct PropertyRecord trackListPropertyRecords[];
+
+gboolean trackListUpdatePlaylist(struct MprisData*);
+void trackListContentChanged(struct MprisData*);
+void trackListTrackInfoChanged(DB_playItem_t*, struct MprisData*);
+void trackListMetadataFormatChanged(struct MprisData*);
+int trackListGetIndex(ddb_playlist_t*, DB_playItem_t*);
+void trackListFree(struct MprisData*);
+
+#endif
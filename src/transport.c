@@ -0,0 +1,243 @@
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "logging.h"
+#include "trackList.h"
+#include "transport.h"
+
+#define BURST_WINDOW 150 // ms
+
+// Coalesces bursts of Next, Previous and Seek calls. The first command is sent right away and opens a window in
+// which further commands are only accumulated. When the window closes they go out as one DeaDBeeF message and the
+// window stays open for another round as long as commands keep coming. Only accessed from the mpris main context.
+static int pendingSteps = 0; // tracks to move, negative for previous
+static gboolean seekPending = FALSE;
+static float pendingSeekOffset = 0; // ms
+static GSource *windowSource = NULL;
+
+// Target of the last seek sent while the window is open. The streamer's play position lags behind until that seek
+// is done, so relative seeks of the same burst start from here.
+static DB_playItem_t *seekTrack = NULL;
+static float seekTarget = 0; // ms
+
+static void forgetSeekTarget(DB_functions_t *deadbeef) {
+	if (seekTrack != NULL) {
+		deadbeef->pl_item_unref(seekTrack);
+		seekTrack = NULL;
+	}
+}
+
+// Index in the playing playlist of the track the last step of the window went to, -1 if unknown. The streamer's
+// playing track lags behind until that step is done, so further steps of the same burst count from here.
+static int stepTarget = -1;
+
+static gboolean usesPrevOrRestart(struct MprisData *mprisData) {
+	return mprisData->previousAction == PREVIOUS_ACTION_PREV_OR_RESTART && mprisData->prevOrRestart
+	       && mprisData->prevOrRestart->callback2 != NULL;
+}
+
+static void sendPrevious(struct MprisData *mprisData) {
+	if (usesPrevOrRestart(mprisData)) {
+		mprisData->prevOrRestart->callback2(mprisData->prevOrRestart, DDB_ACTION_CTX_MAIN);
+	} else {
+		mprisData->deadbeef->sendmessage(DB_EV_PREV, 0, 0, 0);
+	}
+}
+
+static void sendEachStep(int steps, DB_functions_t *deadbeef) {
+	for (int i = 0; i < abs(steps); i++) {
+		deadbeef->sendmessage(steps > 0 ? DB_EV_NEXT : DB_EV_PREV, 0, 0, 0);
+	}
+}
+
+// Index of the track steps positions away from index, -1 past the end of a playlist which does not loop or in an
+// empty one
+static int stepIndex(int index, int steps, int count, DB_functions_t *deadbeef) {
+	if (count <= 0) {
+		return -1;
+	}
+
+	index += steps;
+	if (deadbeef->conf_get_int("playback.loop", PLAYBACK_MODE_LOOP_ALL) == PLAYBACK_MODE_NOLOOP) {
+		return index >= count ? -1 : MAX(index, 0);
+	}
+	return (index % count + count) % count;
+}
+
+static int getPlayingIndex(ddb_playlist_t *pl, DB_functions_t *deadbeef) {
+	DB_playItem_t *track = deadbeef->streamer_get_playing_track();
+	int index = trackListGetIndex(pl, track);
+
+	if (track != NULL) {
+		deadbeef->pl_item_unref(track);
+	}
+	return index;
+}
+
+// Single steps keep going through DB_EV_NEXT and Previous (including prev_or_restart), folded ones in linear order
+// become one DB_EV_PLAY_NUM. Shuffled orders are only known to the streamer, so they still get one
+// DB_EV_NEXT/DB_EV_PREV per step. A folded Previous never restarts: the first Previous of the burst already had the
+// chance to, and prev_or_restart at the start of a track goes to the previous one anyway.
+static void sendSteps(int steps, struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+	int playlistIndex = deadbeef->streamer_get_current_playlist();
+	ddb_playlist_t *pl = NULL;
+	int count = 0;
+	int index = -1;
+	int target = -1;
+
+	forgetSeekTarget(deadbeef);
+
+	if (playlistIndex >= 0
+	    && deadbeef->conf_get_int("playback.order", PLAYBACK_ORDER_LINEAR) == PLAYBACK_ORDER_LINEAR) {
+		pl = deadbeef->plt_get_for_idx(playlistIndex);
+	}
+	if (pl != NULL) {
+		count = deadbeef->plt_get_item_count(pl, PL_MAIN);
+		// playback may have stopped or the playlist shrunk since the last round, then the steps go out one by one
+		index = stepTarget >= 0 ? stepTarget : getPlayingIndex(pl, deadbeef);
+		if (index >= count) {
+			index = -1;
+		}
+	}
+	if (index >= 0) {
+		target = stepIndex(index, steps, count, deadbeef);
+	}
+	stepTarget = target;
+
+	if (steps == 1) {
+		deadbeef->sendmessage(DB_EV_NEXT, 0, 0, 0);
+	} else if (steps == -1) {
+		// whether prev_or_restart went back or restarted is up to DeaDBeeF
+		if (usesPrevOrRestart(mprisData)) {
+			stepTarget = -1;
+		}
+		sendPrevious(mprisData);
+	} else if (index < 0) {
+		sendEachStep(steps, deadbeef);
+	} else if (target < 0) {
+		deadbeef->sendmessage(DB_EV_STOP, 0, 0, 0);
+	} else if (playlistIndex != deadbeef->plt_get_curr_idx()) {
+		// DB_EV_PLAY_NUM plays from the playlist shown in the UI, which is left alone
+		sendEachStep(steps, deadbeef);
+	} else {
+		debug("Jumping %d tracks to %d", steps, target);
+		deadbeef->sendmessage(DB_EV_PLAY_NUM, 0, target, 0);
+	}
+
+	if (pl != NULL) {
+		deadbeef->plt_unref(pl);
+	}
+}
+
+static void sendSeek(float offset, struct MprisData *mprisData) {
+	DB_functions_t *deadbeef = mprisData->deadbeef;
+	DB_playItem_t *track = deadbeef->streamer_get_playing_track();
+
+	if (track == NULL) {
+		return;
+	}
+
+	float duration = deadbeef->pl_get_item_duration(track) * 1000.0;
+	float target = (track == seekTrack ? seekTarget : deadbeef->streamer_get_playpos() * 1000.0) + offset;
+	if (target < 0) {
+		target = 0;
+	}
+
+	forgetSeekTarget(deadbeef);
+	if (target > duration) {
+		stepTarget = -1;
+		deadbeef->sendmessage(DB_EV_NEXT, 0, 0, 0);
+		deadbeef->pl_item_unref(track);
+	} else {
+		deadbeef->sendmessage(DB_EV_SEEK, 0, target, 0);
+		seekTrack = track;
+		seekTarget = target;
+	}
+}
+
+static void flushPending(struct MprisData *mprisData) {
+	if (pendingSteps != 0) {
+		debug("Sending %d coalesced track steps", pendingSteps);
+		sendSteps(pendingSteps, mprisData);
+		pendingSteps = 0;
+	}
+	if (seekPending) {
+		debug("Sending coalesced seek by %f ms", pendingSeekOffset);
+		sendSeek(pendingSeekOffset, mprisData);
+		seekPending = FALSE;
+		pendingSeekOffset = 0;
+	}
+}
+
+static gboolean onWindowClosed(void *userData) {
+	struct MprisData *mprisData = userData;
+
+	if (pendingSteps != 0 || seekPending) {
+		flushPending(mprisData);
+		return G_SOURCE_CONTINUE;
+	}
+
+	g_source_unref(windowSource);
+	windowSource = NULL;
+	forgetSeekTarget(mprisData->deadbeef);
+	stepTarget = -1;
+	return G_SOURCE_REMOVE;
+}
+
+static void openWindow(struct MprisData *mprisData) {
+	windowSource = g_timeout_source_new(BURST_WINDOW);
+	g_source_set_callback(windowSource, onWindowClosed, mprisData, NULL);
+	g_source_attach(windowSource, mprisData->context);
+}
+
+static void queueSteps(int steps, struct MprisData *mprisData) {
+	// keep the order of a seek followed by track changes
+	if (seekPending) {
+		flushPending(mprisData);
+	}
+
+	if (windowSource == NULL) {
+		sendSteps(steps, mprisData);
+		openWindow(mprisData);
+	} else {
+		pendingSteps += steps;
+	}
+}
+
+void transportNext(struct MprisData *mprisData) {
+	queueSteps(1, mprisData);
+}
+
+void transportPrevious(struct MprisData *mprisData) {
+	queueSteps(-1, mprisData);
+}
+
+// offset in us, as Seek gets it
+void transportSeek(int64_t offset, struct MprisData *mprisData) {
+	if (pendingSteps != 0) {
+		flushPending(mprisData);
+	}
+
+	if (windowSource == NULL) {
+		sendSeek(offset / 1000.0, mprisData);
+		openWindow(mprisData);
+	} else {
+		seekPending = TRUE;
+		pendingSeekOffset += offset / 1000.0;
+	}
+}
+
+void transportFree(DB_functions_t *deadbeef) {
+	if (windowSource != NULL) {
+		g_source_destroy(windowSource);
+		g_source_unref(windowSource);
+		windowSource = NULL;
+	}
+	forgetSeekTarget(deadbeef);
+	stepTarget = -1;
+	pendingSteps = 0;
+	seekPending = FALSE;
+	pendingSeekOffset = 0;
+}
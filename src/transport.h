@@ -0,0 +1,11 @@
+#ifndef TRANSPORT_H_
+#define TRANSPORT_H_
+
+#include "mprisServer.h"
+
+void transportNext(struct MprisData*);
+void transportPrevious(struct MprisData*);
+void transportSeek(int64_t, struct MprisData*);
+void transportFree(DB_functions_t*);
+
+#endif